@@ -954,6 +954,112 @@ function(ROOTTEST_ADD_TEST testname)
 
 endfunction(ROOTTEST_ADD_TEST)
 
+#-------------------------------------------------------------------------------
+#
+# function ROOTTEST_ADD_BENCHMARK(testname
+#                                 MACRO|EXEC|COMMAND macro_or_command
+#                                 [MACROARG args1 arg2 ...]
+#                                 [OPTS opt1 opt2 ...]
+#                                 [WARMUP n]
+#                                 [REPETITIONS n]
+#                                 [THREADS n]
+#                                 [WORKING_DIR dir]
+#                                 [TIMEOUT tmout]
+#                                 [LABELS label1 label2 ...]
+#                                 [DEPENDS dep1 dep2 ...]
+#                                 [ENVIRONMENT var1=val1 ...]
+#                                 [COPY_TO_BUILDDIR file1 file2 ...])
+#
+# This function defines a benchmark: the macro or command is run WARMUP times
+# (default 1), then REPETITIONS times (default 5) by scripts/benchmark.py,
+# which reports the median, minimum and spread of the wall and CPU times and
+# writes them to <testname>.benchmark.json. With THREADS, the runs are pinned
+# to that many CPUs, and ROOT_MAX_THREADS and ROOTTEST_BENCHMARK_THREADS are set.
+# Benchmarks are labelled "benchmark" and run serially, such that
+# "ctest -L benchmark" gives comparable numbers. If roottest is configured with
+# -Droottest_perftrack=ON, each benchmark is run once more under pt_collector,
+# recording it in the perftrack store ${ROOTTEST_PT_HISTORY}.
+#
+#-------------------------------------------------------------------------------
+function(ROOTTEST_ADD_BENCHMARK testname)
+  CMAKE_PARSE_ARGUMENTS(ARG ""
+                            "MACROARG;WARMUP;REPETITIONS;THREADS;WORKING_DIR;TIMEOUT"
+                            "MACRO;EXEC;COMMAND;OPTS;LABELS;DEPENDS;ENVIRONMENT;COPY_TO_BUILDDIR" ${ARGN})
+
+  if(ARG_MACRO)
+    ROOTTEST_SETUP_MACROTEST()
+  elseif(ARG_EXEC)
+    ROOTTEST_SETUP_EXECTEST()
+  elseif(ARG_COMMAND)
+    set(command ${ARG_COMMAND})
+  else()
+    message(FATAL_ERROR "ROOTTEST_ADD_BENCHMARK(${testname}) needs a MACRO, EXEC or COMMAND.")
+  endif()
+  # The output of a benchmark is not compared to references.
+  unset(checkstdout)
+  unset(checkstderr)
+  if(ARG_OPTS)
+    set(command ${command} ${ARG_OPTS})
+  endif()
+
+  if(NOT DEFINED ARG_WARMUP)
+    set(ARG_WARMUP 1)
+  endif()
+  if(NOT DEFINED ARG_REPETITIONS)
+    set(ARG_REPETITIONS 5)
+  endif()
+  if(NOT DEFINED ARG_THREADS)
+    set(ARG_THREADS 0)
+  endif()
+
+  ROOTTEST_TARGETNAME_FROM_FILE(testprefix .)
+  set(fulltestname ${testprefix}-${testname})
+
+  set(driver ${PYTHON_EXECUTABLE} ${ROOTTEST_DIR}/scripts/benchmark.py
+             --name ${fulltestname}
+             --warmup ${ARG_WARMUP}
+             --repetitions ${ARG_REPETITIONS}
+             --threads ${ARG_THREADS})
+  set(environment ${ARG_ENVIRONMENT})
+  if(roottest_perftrack)
+    set(driver ${driver} --collector ${ROOTTEST_PT_COLLECTOR} --roottest-home ${ROOTTEST_DIR})
+    set(environment ${environment}
+                    PT_PRELOAD=${ROOTTEST_PT_PRELOAD}
+                    PT_HISTORY=${ROOTTEST_PT_HISTORY})
+  endif()
+
+  # The repetitions multiply the time a single run may take.
+  if(ARG_TIMEOUT)
+    set(timeout ${ARG_TIMEOUT})
+  else()
+    math(EXPR timeout "300 * (${ARG_WARMUP} + ${ARG_REPETITIONS} + 1)")
+  endif()
+
+  if(ARG_WORKING_DIR)
+    set(working_dir WORKING_DIR ${ARG_WORKING_DIR})
+  endif()
+  if(ARG_DEPENDS)
+    set(depends DEPENDS ${ARG_DEPENDS})
+  endif()
+  if(ARG_COPY_TO_BUILDDIR)
+    set(copy_to_builddir COPY_TO_BUILDDIR ${ARG_COPY_TO_BUILDDIR})
+  endif()
+  if(environment)
+    set(environment ENVIRONMENT ${environment})
+  endif()
+
+  ROOTTEST_ADD_TEST(${testname}
+                    COMMAND ${driver} -- ${command}
+                    LABELS benchmark ${ARG_LABELS}
+                    TIMEOUT ${timeout}
+                    RUN_SERIAL
+                    ${working_dir}
+                    ${depends}
+                    ${copy_to_builddir}
+                    ${environment})
+
+endfunction(ROOTTEST_ADD_BENCHMARK)
+
 #-------------------------------------------------------------------------------
 #
 # function ROOTTEST_ADD_UNITTEST_DIR(libraries...)
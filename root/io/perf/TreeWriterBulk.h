@@ -0,0 +1,129 @@
+#ifndef ROOTTEST_TREEWRITERBULK_H
+#define ROOTTEST_TREEWRITERBULK_H
+
+// Basket-at-a-time filling of a leaf-list branch of fundamental type T or of
+// fixed size arrays of T, from data already stored column-wise: instead of
+// one TTree::Fill per entry, each copying every leaf into its basket,
+// Fill(data, n) appends n entries with one array copy per basket, which is
+// written to the file right away.
+//
+//    Float_t px[8];
+//    tree->Branch("px", px, "px[8]/F");
+//    TreeWriterBulk<Float_t> bulk(tree, "px");
+//    bulk.Fill(column, n);     // column holds n * 8 floats, entry by entry
+//    ...
+//    tree->SetEntries();       // once all branches are filled
+//
+// The copy cannot be avoided entirely: baskets are big endian and compressed
+// from their own buffer. It is a memcpy on big endian hosts and a byte swap
+// on little endian ones. Nothing is done per entry: the basket's entry count
+// is set once.
+//
+// Entries can be appended with TTree::Fill before and after bulk fills; a
+// partially filled basket is written out first. As for branches filled with
+// TBranch::Fill, the tree's entry count must be set with TTree::SetEntries,
+// and the tree's auto flush does not see the bulk filled entries.
+
+#include "TBasket.h"
+#include "TBranch.h"
+#include "TBuffer.h"
+#include "TDataType.h"
+#include "TError.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <typeinfo>
+
+template <typename T>
+class TreeWriterBulk {
+public:
+   TreeWriterBulk(TTree *tree, const char *branchName)
+      : fBranch(tree->GetBranch(branchName)), fLen(0), fBasket(nullptr)
+   {
+      if (!fBranch) {
+         Error("TreeWriterBulk", "No branch %s", branchName);
+         return;
+      }
+      const char *typeName = TDataType::GetTypeName(TDataType::GetType(typeid(T)));
+      TLeaf *leaf = fBranch->GetNleaves() == 1 ? (TLeaf *)fBranch->GetListOfLeaves()->UncheckedAt(0) : nullptr;
+      // Fixed size entries only: the basket then has no entry offsets.
+      if (fBranch->IsA() != TBranch::Class() || !leaf || leaf->GetLeafCount() || fBranch->GetEntryOffsetLen() ||
+          TString(leaf->GetTypeName()) != typeName) {
+         Error("TreeWriterBulk", "Branch %s is not a leaf list branch of type %s or %s[N]", branchName, typeName,
+               typeName);
+         fBranch = nullptr;
+         return;
+      }
+      fLen = leaf->GetLenStatic();
+   }
+
+   ~TreeWriterBulk() { delete fBasket; }
+
+   bool IsValid() const { return fBranch; }
+   // Elements per entry.
+   Int_t GetLen() const { return fLen; }
+
+   // Append the n entries stored contiguously at data, GetLen() elements
+   // each. Returns the bytes written to the file, -1 on error.
+   Long64_t Fill(const T *data, Long64_t n)
+   {
+      if (!fBranch)
+         return -1;
+      CloseWriteBasket();
+
+      const Int_t entrySize = fLen * sizeof(T);
+      Long64_t nbytes = 0;
+      for (Long64_t first = 0; first < n;) {
+         if (!fBasket)
+            fBasket = new Basket(fBranch);
+         else
+            fBasket->WriteReset();
+         const Long64_t perBasket = std::max(1, (fBasket->GetBufferSize() - fBasket->GetKeylen()) / entrySize);
+         const Long64_t count = std::min(n - first, perBasket);
+
+         fBasket->SetNevBufSize(entrySize);
+         fBasket->GetBufferRef()->WriteFastArray(data + first * fLen, count * fLen);
+         fBasket->SetNevBuf(count);
+
+         const Int_t nout = fBasket->WriteBuffer();
+         if (nout <= 0) {
+            Error("TreeWriterBulk", "Cannot write a basket of branch %s", fBranch->GetName());
+            return -1;
+         }
+         fBranch->AddBasket(*fBasket, kTRUE, fBranch->GetEntries());
+         nbytes += nout;
+         first += count;
+      }
+      // Where the basket of the next TTree::Fill starts, as after TTreeCloner.
+      fBranch->AddLastBasket(fBranch->GetEntryNumber());
+      return nbytes;
+   }
+
+private:
+   // A basket whose entry count is set at once instead of by one Update()
+   // per entry; written as a TBasket.
+   class Basket : public TBasket {
+   public:
+      Basket(TBranch *branch) : TBasket(branch->GetName(), branch->GetTree()->GetName(), branch) {}
+      void SetNevBuf(Int_t n) { fNevBuf = n; }
+   };
+
+   // Write out the basket TTree::Fill was filling, if any, and drop the empty
+   // one the branch keeps for the next TTree::Fill: AddBasket would take its
+   // slot. TBranch::Fill creates a new one when needed.
+   void CloseWriteBasket()
+   {
+      auto current = static_cast<TBasket *>(fBranch->GetListOfBaskets()->At(fBranch->GetWriteBasket()));
+      if (current && current->GetNevBuf())
+         fBranch->FlushOneBasket(fBranch->GetWriteBasket());
+      fBranch->DropBaskets("all");
+   }
+
+   TBranch *fBranch;
+   Int_t fLen;       // elements per entry
+   Basket *fBasket;  // reused for all baskets written
+};
+
+#endif // ROOTTEST_TREEWRITERBULK_H
@@ -0,0 +1,246 @@
+#ifndef ROOTTEST_ADAPTIVEPARTITIONER_H
+#define ROOTTEST_ADAPTIVEPARTITIONER_H
+
+// Processing of a chain in entry ranges sized by their measured cost, where
+// TTreeProcessorMT uses one task per (group of) clusters whatever their size.
+//
+// One worker per thread takes ranges from a shared cursor. Each range aims
+// at a target duration, SetTargetTaskTime(), from the cost per entry measured
+// on the ranges done so far (the first ranges are small pilots):
+//    - consecutive small clusters are coalesced into one range,
+//    - a cluster holding more entries than the target is split, and
+//    - towards the end, ranges shrink such that the workers finish together.
+// Splitting a cluster costs reading some of its baskets more than once.
+//
+//    AdaptivePartitioner partitioner("T", files);
+//    partitioner.Process([&](TTreeReader &reader) {
+//       TTreeReaderValue<float> x(reader, "x");
+//       while (reader.Next())
+//          ...
+//    }, 8);                             // 8 threads
+//    partitioner.PrintReport();         // task size distribution
+//
+// As for TTreeProcessorMT, the function is called once per range, with a
+// TTreeReader restricted to it, concurrently from several threads. Ranges can
+// cross file boundaries: each worker reads through its own TChain.
+
+#include "RConfigure.h"
+#include "TChain.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+
+#ifdef R__USE_IMT
+#include "ROOT/TThreadExecutor.hxx"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AdaptivePartitioner {
+public:
+   struct Task {
+      Long64_t fFirst;
+      Long64_t fLast; // exclusive
+      double fTime;   // seconds
+      unsigned int fWorker;
+      int fClusters;  // clusters the range starts or ends in, 1 for a piece of one cluster
+   };
+
+   AdaptivePartitioner(const char *treeName, const std::vector<std::string> &files)
+      : fTreeName(treeName), fFiles(files), fTarget(0.02), fPilotEntries(1000), fMinEntries(100),
+        fMaxEntries(-1), fNEntries(0), fCursor(0), fCost(-1), fNWorkers(1)
+   {
+   }
+
+   // Duration each range aims at, in seconds.
+   void SetTargetTaskTime(double seconds) { fTarget = seconds > 0 ? seconds : 0.02; }
+   // Size of the ranges before any cost is measured.
+   void SetPilotEntries(Long64_t n) { fPilotEntries = n > 0 ? n : 1; }
+   // Bounds of the range sizes; max < 0 means no upper bound.
+   void SetEntryLimits(Long64_t min, Long64_t max)
+   {
+      fMinEntries = min > 0 ? min : 1;
+      fMaxEntries = max;
+   }
+
+   // Call func for every range of the chain; nthreads = 0 uses one worker
+   // per hardware thread.
+   bool Process(std::function<void(TTreeReader &)> func, unsigned int nthreads = 0)
+   {
+      if (!MakeClusters())
+         return false;
+      fTasks.clear();
+      fCursor = 0;
+      fCost = -1;
+      fNWorkers = nthreads ? nthreads : std::max(1u, std::thread::hardware_concurrency());
+
+      auto work = [&](unsigned int worker) {
+         TChain chain(fTreeName.c_str());
+         for (auto &file : fFiles)
+            chain.Add(file.c_str());
+         Long64_t first, last;
+         while (NextRange(first, last)) {
+            const auto start = std::chrono::steady_clock::now();
+            {
+               TTreeReader reader(&chain);
+               reader.SetEntriesRange(first, last);
+               func(reader);
+            }
+            Done(first, last, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                 worker);
+         }
+      };
+
+#ifdef R__USE_IMT
+      std::vector<unsigned int> workers(fNWorkers);
+      for (unsigned int w = 0; w < fNWorkers; ++w)
+         workers[w] = w;
+      ROOT::EnableThreadSafety();
+      ROOT::TThreadExecutor pool(fNWorkers);
+      pool.Foreach(work, workers);
+#else
+      fNWorkers = 1;
+      work(0);
+#endif
+      std::sort(fTasks.begin(), fTasks.end(), [](const Task &a, const Task &b) { return a.fFirst < b.fFirst; });
+      return true;
+   }
+
+   // The ranges processed by the last Process(), by first entry.
+   const std::vector<Task> &GetTasks() const { return fTasks; }
+   size_t GetNClusters() const { return fBoundaries.size() > 1 ? fBoundaries.size() - 1 : 0; }
+
+   // Distribution of the range sizes and durations, and the balance of the
+   // workers: the busiest worker's time over the mean.
+   void PrintReport(FILE *out = stdout) const
+   {
+      if (fTasks.empty()) {
+         fprintf(out, "no tasks\n");
+         return;
+      }
+      std::vector<double> entries, times, busy(fNWorkers, 0);
+      int split = 0, coalesced = 0;
+      for (auto &task : fTasks) {
+         entries.push_back(task.fLast - task.fFirst);
+         times.push_back(task.fTime);
+         busy[task.fWorker] += task.fTime;
+         if (task.fClusters > 1)
+            ++coalesced;
+         else if (!IsCluster(task.fFirst, task.fLast))
+            ++split;
+      }
+      double total = 0;
+      for (auto b : busy)
+         total += b;
+      fprintf(out, "%zu tasks over %zu clusters (%d pieces of clusters, %d coalesced ranges), %u workers\n",
+              fTasks.size(), GetNClusters(), split, coalesced, fNWorkers);
+      fprintf(out, "%-12s %12s %12s %12s %12s %12s\n", "", "min", "10%", "median", "90%", "max");
+      PrintQuantiles(out, "entries", entries, 1);
+      PrintQuantiles(out, "time [ms]", times, 1e3);
+      fprintf(out, "worker imbalance (max / mean busy time): %.3f\n",
+              total > 0 ? *std::max_element(busy.begin(), busy.end()) / (total / fNWorkers) : 0.);
+   }
+
+private:
+   // Cluster boundaries of the whole chain, from 0 to the number of entries.
+   bool MakeClusters()
+   {
+      fBoundaries.assign(1, 0);
+      fNEntries = 0;
+      for (auto &name : fFiles) {
+         std::unique_ptr<TFile> file(TFile::Open(name.c_str()));
+         TTree *tree = nullptr;
+         if (file && !file->IsZombie())
+            file->GetObject(fTreeName.c_str(), tree);
+         if (!tree) {
+            Error("AdaptivePartitioner", "Cannot read tree %s from %s", fTreeName.c_str(), name.c_str());
+            return false;
+         }
+         const Long64_t nentries = tree->GetEntries();
+         auto clusters = tree->GetClusterIterator(0);
+         Long64_t start;
+         while ((start = clusters()) < nentries) {
+            Long64_t end = std::min(clusters.GetNextEntry(), nentries);
+            fBoundaries.push_back(fNEntries + end);
+         }
+         fNEntries += nentries;
+      }
+      return true;
+   }
+
+   bool IsCluster(Long64_t first, Long64_t last) const
+   {
+      return std::binary_search(fBoundaries.begin(), fBoundaries.end(), first) &&
+             std::binary_search(fBoundaries.begin(), fBoundaries.end(), last);
+   }
+
+   bool NextRange(Long64_t &first, Long64_t &last)
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      if (fCursor >= fNEntries)
+         return false;
+      first = fCursor;
+      Long64_t desired = fCost > 0 ? Long64_t(fTarget / fCost) : fPilotEntries;
+      // Guided tail: leave work for every worker.
+      desired = std::min(desired, (fNEntries - first) / (2 * fNWorkers));
+      if (fMaxEntries > 0)
+         desired = std::min(desired, fMaxEntries);
+      desired = std::max(desired, fMinEntries);
+
+      auto it = std::upper_bound(fBoundaries.begin(), fBoundaries.end(), first);
+      last = *it;
+      if (first + desired >= last) {
+         // Coalesce the following clusters that fit.
+         while (it + 1 != fBoundaries.end() && *(it + 1) - first <= desired)
+            last = *++it;
+      } else if (last - (first + desired) >= desired / 2) {
+         // Split the cluster, unless the rest would be a small piece.
+         last = first + desired;
+      }
+      fCursor = last;
+      return true;
+   }
+
+   void Done(Long64_t first, Long64_t last, double seconds, unsigned int worker)
+   {
+      auto begin = std::upper_bound(fBoundaries.begin(), fBoundaries.end(), first);
+      auto end = std::lower_bound(fBoundaries.begin(), fBoundaries.end(), last);
+      std::lock_guard<std::mutex> lock(fMutex);
+      const double cost = seconds / (last - first);
+      fCost = fCost > 0 ? 0.7 * fCost + 0.3 * cost : cost;
+      fTasks.push_back({first, last, seconds, worker, int(end - begin) + 1});
+   }
+
+   static void PrintQuantiles(FILE *out, const char *name, std::vector<double> v, double scale)
+   {
+      std::sort(v.begin(), v.end());
+      auto q = [&v, scale](double f) { return scale * v[std::min(v.size() - 1, size_t(f * v.size()))]; };
+      fprintf(out, "%-12s %12.4g %12.4g %12.4g %12.4g %12.4g\n", name, q(0), q(0.1), q(0.5), q(0.9),
+              scale * v.back());
+   }
+
+   std::string fTreeName;
+   std::vector<std::string> fFiles;
+   double fTarget;
+   Long64_t fPilotEntries;
+   Long64_t fMinEntries;
+   Long64_t fMaxEntries;
+   std::vector<Long64_t> fBoundaries;
+   Long64_t fNEntries;
+   std::mutex fMutex; // protects fCursor, fCost and fTasks
+   Long64_t fCursor;
+   double fCost;     // seconds per entry, < 0 before the first range is done
+   unsigned int fNWorkers;
+   std::vector<Task> fTasks;
+};
+
+#endif // ROOTTEST_ADAPTIVEPARTITIONER_H
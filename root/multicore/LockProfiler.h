@@ -0,0 +1,297 @@
+#ifndef ROOTTEST_LOCKPROFILER_H
+#define ROOTTEST_LOCKPROFILER_H
+
+// Contention profile of ROOT's core mutex (ROOT::gCoreMutex, which is also
+// gInterpreterMutex and gROOTMutex once thread safety is enabled): for every
+// call site taking it, through R__LOCKGUARD or the read / write guards, the
+// number of read and write acquisitions, the time spent waiting for them and
+// the time the lock was then held.
+//
+//    ROOT::EnableThreadSafety();
+//    auto profiler = LockProfiler::InstallIfRequested(); // before the threads
+//    ... threads ...
+//    if (profiler)
+//       profiler->WriteJSON("mytest_locks.json");
+//
+// Profiling is opt-in: InstallIfRequested() only installs the profiler if
+// the environment variable ROOTTEST_LOCK_PROFILE is set (and not 0), such
+// that the tests normally run on the stock mutex they were written to check.
+// Interpreted macros load the profiler compiled, with ".L LockProfiler.h+".
+//
+// The profiler wraps the core mutex and forwards every call to it. A call
+// site is the return address of the lock call, reported as function+offset
+// where the dynamic linker knows the function. Lock releases through
+// Rewind() are not seen: the hold time of such locks runs until their
+// matching unlock.
+//
+// Each thread records into its own table, under a mutex of that table which
+// only GetSites() contends for; past a thread's first acquisition at a site,
+// recording allocates nothing.
+
+#include "TError.h"
+#include "TInterpreter.h"
+#include "TROOT.h"
+#include "TVirtualMutex.h"
+#include "TVirtualRWMutex.h"
+
+#include "../../scripts/benchmarkresults.h"
+
+#ifndef _WIN32
+#include <cxxabi.h>
+#include <dlfcn.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LOCKPROFILER_CALLER _ReturnAddress()
+#else
+#define LOCKPROFILER_CALLER __builtin_return_address(0)
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class LockProfiler : public ROOT::TVirtualRWMutex {
+public:
+   struct Site {
+      Long64_t fReads = 0;
+      Long64_t fWrites = 0;
+      double fWait = 0;    // seconds
+      double fMaxWait = 0; // seconds
+      double fHold = 0;    // seconds
+   };
+
+   // Wrap the core mutex; ROOT::EnableThreadSafety() must have been called.
+   static LockProfiler *Install()
+   {
+      LockProfiler *&profiler = Instance();
+      if (profiler)
+         return profiler;
+      if (!ROOT::gCoreMutex) {
+         Error("LockProfiler", "Thread safety is not enabled: call ROOT::EnableThreadSafety() first");
+         return nullptr;
+      }
+      TVirtualMutex *inner = ROOT::gCoreMutex;
+      profiler = new LockProfiler(ROOT::gCoreMutex);
+      if (gInterpreterMutex == inner)
+         gInterpreterMutex = profiler;
+      if (gROOTMutex == inner)
+         gROOTMutex = profiler;
+      ROOT::gCoreMutex = profiler;
+      return profiler;
+   }
+
+   // Install() if ROOTTEST_LOCK_PROFILE is set and not 0; nullptr otherwise.
+   static LockProfiler *InstallIfRequested()
+   {
+      const char *env = getenv("ROOTTEST_LOCK_PROFILE");
+      if (!env || !env[0] || !strcmp(env, "0"))
+         return nullptr;
+      return Install();
+   }
+
+   // The installed profiler, nullptr if none.
+   static LockProfiler *Get() { return Instance(); }
+
+   Hint_t *ReadLock() override { return Acquire(LOCKPROFILER_CALLER, false); }
+   void ReadUnLock(Hint_t *hint) override { Release(hint, false); }
+   Hint_t *WriteLock() override { return Acquire(LOCKPROFILER_CALLER, true); }
+   void WriteUnLock(Hint_t *hint) override { Release(hint, true); }
+   // TLockGuard, i.e. R__LOCKGUARD, locks through these.
+   Int_t Lock() override
+   {
+      Acquire(LOCKPROFILER_CALLER, true);
+      return 1;
+   }
+   Int_t TryLock() override
+   {
+      Acquire(LOCKPROFILER_CALLER, true);
+      return 1;
+   }
+   Int_t UnLock() override
+   {
+      Release(nullptr, true);
+      return 0;
+   }
+   Int_t CleanUp() override
+   {
+      Release(nullptr, true);
+      return 0;
+   }
+
+   ROOT::TVirtualRWMutex *Factory(Bool_t recursive = kFALSE) override { return fInner->Factory(recursive); }
+   std::unique_ptr<StateDelta> Rewind(const State &earlierState) override { return fInner->Rewind(earlierState); }
+   void Apply(std::unique_ptr<StateDelta> &&delta) override { fInner->Apply(std::move(delta)); }
+   std::unique_ptr<State> GetStateBefore() override { return fInner->GetStateBefore(); }
+
+   // The call sites seen so far, by name, most waited for first.
+   std::vector<std::pair<std::string, Site>> GetSites() const
+   {
+      std::map<const void *, Site> copy;
+      {
+         std::lock_guard<std::mutex> lock(fTablesMutex);
+         for (auto &table : fTables) {
+            std::lock_guard<std::mutex> tableLock(table->fMutex);
+            for (auto &site : table->fSites)
+               Add(copy[site.first], site.second);
+         }
+      }
+      // Several return addresses can resolve to the same name.
+      std::map<std::string, Site> byName;
+      for (auto &site : copy) {
+         Add(byName[SiteName(site.first)], site.second);
+      }
+      std::vector<std::pair<std::string, Site>> sites(byName.begin(), byName.end());
+      std::sort(sites.begin(), sites.end(), [](const std::pair<std::string, Site> &a,
+                                               const std::pair<std::string, Site> &b) {
+         return a.second.fWait > b.second.fWait;
+      });
+      return sites;
+   }
+
+   void Print(FILE *out = stdout) const
+   {
+      auto sites = GetSites();
+      fprintf(out, "%10s %10s %12s %14s %12s  %s\n", "reads", "writes", "wait [ms]", "max wait [us]", "hold [ms]",
+              "call site");
+      for (auto &site : sites) {
+         const Site &s = site.second;
+         fprintf(out, "%10lld %10lld %12.3f %14.1f %12.3f  %s\n", s.fReads, s.fWrites, 1e3 * s.fWait,
+                 1e6 * s.fMaxWait, 1e3 * s.fHold, site.first.c_str());
+      }
+   }
+
+   bool WriteJSON(const char *output) const
+   {
+      BenchmarkJSON json(output);
+      if (!json.IsOpen())
+         return false;
+      json.BeginArray();
+      for (auto &site : GetSites()) {
+         const Site &s = site.second;
+         json.BeginObject().Add("site", site.first.c_str()).Add("reads", s.fReads).Add("writes", s.fWrites)
+            .Add("wait_s", s.fWait).Add("maxwait_s", s.fMaxWait).Add("hold_s", s.fHold).EndObject();
+      }
+      json.EndArray();
+      return true;
+   }
+
+private:
+   using Clock = std::chrono::steady_clock;
+
+   // An acquisition not yet released.
+   struct Frame {
+      const void *fSite;
+      Clock::time_point fAcquired;
+   };
+
+   // The sites and open acquisitions of one thread.
+   struct Table {
+      std::mutex fMutex; // taken by its thread and by GetSites()
+      std::unordered_map<const void *, Site> fSites;
+      std::vector<Frame> fFrames;
+   };
+
+   LockProfiler(ROOT::TVirtualRWMutex *inner) : fInner(inner) {}
+
+   static LockProfiler *&Instance()
+   {
+      static LockProfiler *profiler = nullptr;
+      return profiler;
+   }
+
+   static void Add(Site &to, const Site &from)
+   {
+      to.fReads += from.fReads;
+      to.fWrites += from.fWrites;
+      to.fWait += from.fWait;
+      to.fMaxWait = std::max(to.fMaxWait, from.fMaxWait);
+      to.fHold += from.fHold;
+   }
+
+   // The calling thread's table, registered on its first use. Tables live as
+   // long as the profiler, i.e. until the end of the process.
+   Table &LocalTable()
+   {
+      thread_local Table *table = nullptr;
+      if (!table) {
+         table = new Table;
+         table->fFrames.reserve(16);
+         std::lock_guard<std::mutex> lock(fTablesMutex);
+         fTables.emplace_back(table);
+      }
+      return *table;
+   }
+
+   Hint_t *Acquire(const void *site, bool write)
+   {
+      Table &table = LocalTable();
+      const auto start = Clock::now();
+      Hint_t *hint = write ? fInner->WriteLock() : fInner->ReadLock();
+      const auto acquired = Clock::now();
+      const double wait = std::chrono::duration<double>(acquired - start).count();
+
+      std::lock_guard<std::mutex> lock(table.fMutex);
+      Site &s = table.fSites[site];
+      if (write)
+         ++s.fWrites;
+      else
+         ++s.fReads;
+      s.fWait += wait;
+      s.fMaxWait = std::max(s.fMaxWait, wait);
+      table.fFrames.push_back({site, acquired});
+      return hint;
+   }
+
+   void Release(Hint_t *hint, bool write)
+   {
+      {
+         const auto released = Clock::now();
+         Table &table = LocalTable();
+         std::lock_guard<std::mutex> lock(table.fMutex);
+         // Locks taken before Install() have no frame.
+         if (!table.fFrames.empty()) {
+            const Frame &frame = table.fFrames.back();
+            table.fSites[frame.fSite].fHold += std::chrono::duration<double>(released - frame.fAcquired).count();
+            table.fFrames.pop_back();
+         }
+      }
+      if (write)
+         fInner->WriteUnLock(hint);
+      else
+         fInner->ReadUnLock(hint);
+   }
+
+   static std::string SiteName(const void *site)
+   {
+#ifndef _WIN32
+      Dl_info info;
+      if (dladdr(site, &info) && info.dli_sname) {
+         int status = 0;
+         char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+         std::string name = demangled ? demangled : info.dli_sname;
+         free(demangled);
+         char offset[32];
+         snprintf(offset, sizeof(offset), "+0x%lx", (unsigned long)((const char *)site - (const char *)info.dli_saddr));
+         return name + offset;
+      }
+#endif
+      char address[32];
+      snprintf(address, sizeof(address), "%p", site);
+      return address;
+   }
+
+   ROOT::TVirtualRWMutex *fInner;
+   mutable std::mutex fTablesMutex; // protects fTables
+   std::vector<std::unique_ptr<Table>> fTables;
+};
+
+#endif // ROOTTEST_LOCKPROFILER_H
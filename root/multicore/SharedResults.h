@@ -0,0 +1,316 @@
+#ifndef ROOTTEST_SHAREDRESULTS_H
+#define ROOTTEST_SHAREDRESULTS_H
+
+// Map-reduce over forked workers that hand their results back to the parent
+// through shared memory, where TProcessExecutor streams every result over a
+// socket.
+//
+// Before forking, the parent maps one shared anonymous region per worker.
+// Each worker runs its tasks (w, w + nworkers, ...), merges their results
+// and writes the merged one into its region:
+//    kStreamed  the object, streamed with a TBufferFile; the parent reads it
+//               straight from the region, without a socket in between.
+//    kInPlace   for histograms with fixed bins and no buffer, the bin
+//               contents, sum of weights squared and statistics as raw
+//               arrays; the parent adds them to its result in place, without
+//               building an object. Worker 0 still streams its histogram,
+//               which becomes the result; other objects are streamed.
+//
+//    SharedResultExecutor pool(4);
+//    TH1F *h = pool.MapReduce<TH1F>([](unsigned int task) {
+//       auto h = new TH1F("h", "h", 1000000, 0, 1);
+//       ... fill ...
+//       return h;
+//    }, 16);
+//
+// The results must have a Merge(TCollection *) member; kInPlace requires all
+// histograms to have the same binning. A region holds at most `capacity`
+// bytes: the pages are only allocated when written.
+
+#include "TArrayD.h"
+#include "TArrayF.h"
+#include "TAxis.h"
+#include "TBufferFile.h"
+#include "TError.h"
+#include "TH1.h"
+#include "TList.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// Merge all non-null objects into the first one and delete the others.
+template <class T>
+T *MergeResults(const std::vector<T *> &objs)
+{
+   T *target = nullptr;
+   TList list;
+   for (auto obj : objs) {
+      if (!obj)
+         continue;
+      if (!target)
+         target = obj;
+      else
+         list.Add(obj);
+   }
+   if (target && list.GetSize())
+      target->Merge(&list);
+   list.Delete();
+   return target;
+}
+
+class SharedResultExecutor {
+public:
+   enum ETransport { kStreamed, kInPlace };
+
+   SharedResultExecutor(unsigned int nworkers = 0, size_t capacity = size_t(1) << 30)
+      : fNWorkers(nworkers ? nworkers : std::max(1u, std::thread::hardware_concurrency())),
+        fCapacity(std::max(capacity, sizeof(Header)))
+   {
+   }
+
+   unsigned int GetNWorkers() const { return fNWorkers; }
+
+   // Run func(task) for tasks 0 to ntasks - 1 in the workers and merge the
+   // results; nullptr if a worker failed.
+   template <class T>
+   T *MapReduce(std::function<T *(unsigned int)> func, unsigned int ntasks, ETransport transport = kInPlace)
+   {
+      std::vector<char *> regions;
+      for (unsigned int w = 0; w < fNWorkers; ++w) {
+         void *region = mmap(nullptr, fCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+                             -1, 0);
+         if (region == MAP_FAILED) {
+            SysError("SharedResultExecutor", "Cannot map %zu bytes", fCapacity);
+            Unmap(regions);
+            return nullptr;
+         }
+         regions.push_back(static_cast<char *>(region));
+      }
+
+      bool ok = true;
+      std::vector<pid_t> pids;
+      for (unsigned int w = 0; w < fNWorkers; ++w) {
+         const pid_t pid = fork();
+         if (pid < 0) {
+            SysError("SharedResultExecutor", "Cannot fork worker %u", w);
+            ok = false;
+            break;
+         }
+         if (pid == 0) {
+            // Skip the atexit handlers and destructors of the parent's state.
+            _exit(RunWorker(func, ntasks, w, transport, regions[w]) ? 0 : 1);
+         }
+         pids.push_back(pid);
+      }
+      for (auto pid : pids) {
+         int status = 0;
+         if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            Error("SharedResultExecutor", "Worker %d failed", (int)pid);
+            ok = false;
+         }
+      }
+
+      T *result = nullptr;
+      if (ok)
+         result = Collect<T>(regions);
+      Unmap(regions);
+      return result;
+   }
+
+private:
+   enum EStatus { kEmpty, kObject, kArrays, kTooLarge };
+
+   // The start of a region; kArrays are followed by the bin contents, of
+   // fElementSize bytes each, then by the sum of weights squared if any.
+   struct Header {
+      Int_t fStatus;
+      Int_t fElementSize;
+      Long64_t fSize; // bytes after the header
+      Int_t fNcells;
+      Int_t fHasSumw2;
+      Int_t fNbins[3];
+      Double_t fMin[3];
+      Double_t fMax[3];
+      Double_t fEntries;
+      Double_t fStats[TH1::kNstat];
+   };
+
+   static size_t Align(size_t n) { return (n + 7) & ~size_t(7); }
+
+   void Unmap(std::vector<char *> &regions) const
+   {
+      for (auto region : regions)
+         munmap(region, fCapacity);
+      regions.clear();
+   }
+
+   template <class T>
+   bool RunWorker(std::function<T *(unsigned int)> &func, unsigned int ntasks, unsigned int worker,
+                  ETransport transport, char *region) const
+   {
+      Header &header = *reinterpret_cast<Header *>(region);
+      header.fStatus = kEmpty;
+      std::vector<T *> results;
+      for (unsigned int task = worker; task < ntasks; task += fNWorkers)
+         results.push_back(func(task));
+      T *result = MergeResults(results);
+      if (!result)
+         return true;
+      TH1 *hist = dynamic_cast<TH1 *>(static_cast<TObject *>(result));
+      if (!(transport == kInPlace && worker > 0 && hist && WriteArrays(*hist, region)))
+         WriteObject(*result, region);
+      if (header.fStatus == kTooLarge)
+         fprintf(stderr, "Worker %u: result larger than the region of %zu bytes\n", worker, fCapacity);
+      return header.fStatus != kTooLarge;
+   }
+
+   void WriteObject(const TObject &obj, char *region) const
+   {
+      Header &header = *reinterpret_cast<Header *>(region);
+      TBufferFile buf(TBuffer::kWrite);
+      buf.WriteObject(&obj);
+      if (sizeof(Header) + buf.Length() > fCapacity) {
+         header.fStatus = kTooLarge;
+         return;
+      }
+      memcpy(region + sizeof(Header), buf.Buffer(), buf.Length());
+      header.fSize = buf.Length();
+      header.fStatus = kObject;
+   }
+
+   // False if the histogram cannot be sent as arrays.
+   bool WriteArrays(TH1 &hist, char *region) const
+   {
+      const TArrayF *arrayF = dynamic_cast<TArrayF *>(&hist);
+      const TArrayD *arrayD = dynamic_cast<TArrayD *>(&hist);
+      if (hist.GetBuffer() || (!arrayF && !arrayD))
+         return false;
+      Header &header = *reinterpret_cast<Header *>(region);
+      const TAxis *axes[3] = {hist.GetXaxis(), hist.GetYaxis(), hist.GetZaxis()};
+      for (int a = 0; a < 3; ++a) {
+         if (axes[a]->GetXbins()->GetSize())
+            return false;
+         header.fNbins[a] = axes[a]->GetNbins();
+         header.fMin[a] = axes[a]->GetXmin();
+         header.fMax[a] = axes[a]->GetXmax();
+      }
+      header.fNcells = hist.GetNcells();
+      header.fElementSize = arrayF ? sizeof(Float_t) : sizeof(Double_t);
+      header.fHasSumw2 = hist.GetSumw2N() > 0;
+      const size_t contents = Align(header.fNcells * header.fElementSize);
+      header.fSize = contents + (header.fHasSumw2 ? header.fNcells * sizeof(Double_t) : 0);
+      if (sizeof(Header) + header.fSize > fCapacity)
+         return false;
+
+      char *data = region + sizeof(Header);
+      memcpy(data, arrayF ? (const void *)arrayF->GetArray() : (const void *)arrayD->GetArray(),
+             header.fNcells * header.fElementSize);
+      if (header.fHasSumw2)
+         memcpy(data + contents, hist.GetSumw2()->GetArray(), header.fNcells * sizeof(Double_t));
+      header.fEntries = hist.GetEntries();
+      hist.GetStats(header.fStats);
+      header.fStatus = kArrays;
+      return true;
+   }
+
+   // Add the arrays of a region to the histogram.
+   static bool AddArrays(TH1 &hist, const Header &header, const char *data)
+   {
+      TArrayF *arrayF = dynamic_cast<TArrayF *>(&hist);
+      TArrayD *arrayD = dynamic_cast<TArrayD *>(&hist);
+      bool same = hist.GetNcells() == header.fNcells &&
+                  (arrayF ? header.fElementSize == sizeof(Float_t) : arrayD && header.fElementSize == sizeof(Double_t));
+      const TAxis *axes[3] = {hist.GetXaxis(), hist.GetYaxis(), hist.GetZaxis()};
+      for (int a = 0; a < 3 && same; ++a)
+         same = axes[a]->GetNbins() == header.fNbins[a] && axes[a]->GetXmin() == header.fMin[a] &&
+                axes[a]->GetXmax() == header.fMax[a];
+      if (!same) {
+         Error("SharedResultExecutor", "Histogram %s: the workers' binnings differ", hist.GetName());
+         return false;
+      }
+      if (hist.GetBuffer())
+         hist.BufferEmpty(1);
+
+      const Int_t ncells = header.fNcells;
+      Double_t stats[TH1::kNstat];
+      hist.GetStats(stats);
+      const Double_t entries = hist.GetEntries();
+      if (arrayF) {
+         Float_t *to = arrayF->GetArray();
+         const Float_t *from = reinterpret_cast<const Float_t *>(data);
+         for (Int_t i = 0; i < ncells; ++i)
+            to[i] += from[i];
+      } else {
+         Double_t *to = arrayD->GetArray();
+         const Double_t *from = reinterpret_cast<const Double_t *>(data);
+         for (Int_t i = 0; i < ncells; ++i)
+            to[i] += from[i];
+      }
+      if (header.fHasSumw2) {
+         // Without sum of weights squared, the target was filled with weights 1.
+         if (!hist.GetSumw2N())
+            hist.Sumw2();
+         Double_t *to = hist.GetSumw2()->GetArray();
+         const Double_t *from = reinterpret_cast<const Double_t *>(data + Align(ncells * header.fElementSize));
+         for (Int_t i = 0; i < ncells; ++i)
+            to[i] += from[i];
+      } else if (hist.GetSumw2N()) {
+         Double_t *to = hist.GetSumw2()->GetArray();
+         for (Int_t i = 0; i < ncells; ++i)
+            to[i] += arrayF ? reinterpret_cast<const Float_t *>(data)[i] : reinterpret_cast<const Double_t *>(data)[i];
+      }
+      for (int i = 0; i < TH1::kNstat; ++i)
+         stats[i] += header.fStats[i];
+      hist.PutStats(stats);
+      hist.SetEntries(entries + header.fEntries);
+      return true;
+   }
+
+   template <class T>
+   T *Collect(const std::vector<char *> &regions) const
+   {
+      std::vector<T *> objects;
+      for (auto region : regions) {
+         const Header &header = *reinterpret_cast<const Header *>(region);
+         if (header.fStatus != kObject)
+            continue;
+         TBufferFile buf(TBuffer::kRead, header.fSize, region + sizeof(Header), kFALSE);
+         objects.push_back(dynamic_cast<T *>(buf.ReadObject(T::Class())));
+      }
+      T *result = MergeResults(objects);
+
+      for (auto region : regions) {
+         const Header &header = *reinterpret_cast<const Header *>(region);
+         if (header.fStatus != kArrays)
+            continue;
+         TH1 *hist = dynamic_cast<TH1 *>(static_cast<TObject *>(result));
+         if (!hist || !AddArrays(*hist, header, region + sizeof(Header))) {
+            if (!hist)
+               Error("SharedResultExecutor", "No histogram to add the arrays to");
+            delete result;
+            return nullptr;
+         }
+      }
+      return result;
+   }
+
+   unsigned int fNWorkers;
+   size_t fCapacity; // bytes per worker region
+};
+
+#endif // ROOTTEST_SHAREDRESULTS_H
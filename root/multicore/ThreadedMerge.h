@@ -0,0 +1,189 @@
+#ifndef ROOTTEST_THREADEDMERGE_H
+#define ROOTTEST_THREADEDMERGE_H
+
+// Parallel merge of per-thread objects, and per-thread objects looked up
+// without a lock.
+//
+// ParallelMergeTObjects<T>(pool) is a merge function for TThreadedObject<T>::Merge
+// that replaces the serial merge of all slots into the first one by a tree
+// reduction: slots are merged pairwise, the pairs of each round in parallel
+// (with IMT in a thread pool), in log2(slots) rounds.
+//
+//    ROOT::TThreadedObject<TH1D> h("h", "h", 100, 0, 1);
+//    ... fill from threads ...
+//    ROOT::TThreadExecutor pool;       // one pool for all merges
+//    auto merged = h.Merge(ParallelMergeTObjects<TH1D>(pool));
+//
+// ThreadSlots<T> holds one copy of a model per thread, like TThreadedObject,
+// but finds the calling thread's copy through an index kept in a
+// thread_local, instead of a lookup in a map under a lock. The index of a
+// thread is given to the next new thread once it exits, which then
+// continues to fill the same copy:
+//
+//    TH1::AddDirectory(false);     // copies are made from several threads
+//    ThreadSlots<TH1D> slots(TH1D("h", "h", 100, 0, 1));
+//    ... slots.Get()->Fill(x) from threads ...
+//    auto merged = slots.Merge();
+//
+// T must have a Merge(TCollection *) member, as TThreadedObject requires, and
+// merging two distinct objects must be possible concurrently with merging
+// two others.
+
+#include "RConfigure.h"
+#include "TError.h"
+#include "TList.h"
+
+#ifdef R__USE_IMT
+#include "ROOT/TThreadExecutor.hxx"
+#endif
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+template <class T>
+using ThreadedMergeFunction_t = std::function<void(std::shared_ptr<T>, std::vector<std::shared_ptr<T>> &)>;
+
+namespace ROOT {
+class TThreadExecutor;
+}
+
+// Tree reduction of the non-null objects of objs into objs[0]; if objs[0] is
+// null, the first non-null object is moved there first. The merges of a
+// round run in pool, serially without pool or without IMT.
+template <class T>
+void TreeMergeTObjects(std::vector<std::shared_ptr<T>> &objs, ROOT::TThreadExecutor *pool)
+{
+   std::vector<size_t> used;
+   for (size_t i = 0; i < objs.size(); ++i)
+      if (objs[i])
+         used.push_back(i);
+   if (used.empty())
+      return;
+   if (used[0] != 0) {
+      std::swap(objs[0], objs[used[0]]);
+      used[0] = 0;
+   }
+
+   for (size_t stride = 1; stride < used.size(); stride *= 2) {
+      std::vector<unsigned int> pairs;
+      for (size_t i = 0; i + stride < used.size(); i += 2 * stride)
+         pairs.push_back(i);
+      auto mergePair = [&](unsigned int i) {
+         TList list;
+         list.Add(objs[used[i + stride]].get());
+         objs[used[i]]->Merge(&list);
+      };
+#ifdef R__USE_IMT
+      if (pool) {
+         pool->Foreach(mergePair, pairs);
+         continue;
+      }
+#endif
+      for (auto i : pairs)
+         mergePair(i);
+   }
+}
+
+// Merge function running the tree reduction in pool, which must outlive it;
+// one pool serves the merges of many objects.
+template <class T>
+ThreadedMergeFunction_t<T> ParallelMergeTObjects(ROOT::TThreadExecutor &pool)
+{
+   return [&pool](std::shared_ptr<T>, std::vector<std::shared_ptr<T>> &objs) { TreeMergeTObjects(objs, &pool); };
+}
+
+// Merge function running the tree reduction in a pool of its own, made at
+// each call; nthreads = 0 uses the default pool size.
+template <class T>
+ThreadedMergeFunction_t<T> ParallelMergeTObjects(unsigned int nthreads = 0)
+{
+   return [nthreads](std::shared_ptr<T>, std::vector<std::shared_ptr<T>> &objs) {
+#ifdef R__USE_IMT
+      ROOT::TThreadExecutor pool(nthreads);
+      TreeMergeTObjects(objs, &pool);
+#else
+      (void)nthreads;
+      TreeMergeTObjects<T>(objs, nullptr);
+#endif
+   };
+}
+
+template <class T>
+class ThreadSlots {
+public:
+   // At most `capacity` threads can call Get() at the same time.
+   ThreadSlots(const T &model, unsigned int capacity = 256) : fModel(model), fSlots(capacity) {}
+
+   // The calling thread's copy of the model; nullptr past the capacity.
+   T *Get()
+   {
+      const unsigned int slot = ThreadIndex();
+      if (slot >= fSlots.size()) {
+         Error("ThreadSlots", "More than %zu threads", fSlots.size());
+         return nullptr;
+      }
+      // A slot is used by one thread at a time.
+      if (!fSlots[slot])
+         fSlots[slot].reset(new T(fModel));
+      return fSlots[slot].get();
+   }
+
+   std::vector<std::shared_ptr<T>> &GetSlots() { return fSlots; }
+
+   // Merge all copies; call it once no thread fills anymore.
+   std::shared_ptr<T> Merge(ThreadedMergeFunction_t<T> mergeFunction = ParallelMergeTObjects<T>())
+   {
+      mergeFunction(fSlots[0], fSlots);
+      return fSlots[0];
+   }
+
+private:
+   // The process-wide index of a running thread, given back when it exits.
+   class Index {
+   public:
+      Index()
+      {
+         Registry &registry = GetRegistry();
+         std::lock_guard<std::mutex> lock(registry.fMutex);
+         if (registry.fFree.empty()) {
+            fValue = registry.fNext++;
+         } else {
+            fValue = registry.fFree.back();
+            registry.fFree.pop_back();
+         }
+      }
+      ~Index()
+      {
+         Registry &registry = GetRegistry();
+         std::lock_guard<std::mutex> lock(registry.fMutex);
+         registry.fFree.push_back(fValue);
+      }
+      unsigned int fValue;
+   };
+
+   struct Registry {
+      std::mutex fMutex;
+      unsigned int fNext = 0;
+      std::vector<unsigned int> fFree;
+   };
+
+   static Registry &GetRegistry()
+   {
+      static Registry registry;
+      return registry;
+   }
+
+   // Lock-free but for the first call of each thread.
+   static unsigned int ThreadIndex()
+   {
+      thread_local Index index;
+      return index.fValue;
+   }
+
+   T fModel;
+   std::vector<std::shared_ptr<T>> fSlots;
+};
+
+#endif // ROOTTEST_THREADEDMERGE_H
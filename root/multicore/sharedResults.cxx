@@ -0,0 +1,190 @@
+// Transport of the results of forked workers to the parent, for TH1F, TH2D
+// and TTree results of growing size:
+//    socket    TProcessExecutor::MapReduce: every result streamed over a
+//              socket and read back into a new object, then merged
+//    streamed  SharedResults.h, kStreamed: streamed into shared memory and
+//              read from there
+//    inplace   SharedResults.h, kInPlace: histograms as raw arrays in shared
+//              memory, added to the result in place (trees are streamed)
+// As in tProcessExecutorH1Test, one task per worker fills histograms, and
+// the parent gets their merge; the histograms are filled with the same
+// number of random entries whatever their size, so the time on top of the
+// fills grows with the transport. All transports must give the same result.
+//
+//    sharedResults [workers] [max cells] [repetitions] [output]
+//
+// Sizes go from 10^4 cells (bins or tree entries) by factors of 10 up to the
+// maximum. It reports the median time of the repetitions. The results go to
+// the JSON file `output` and to stdout.
+
+#include "SharedResults.h"
+#include "../../scripts/benchmarkresults.h"
+
+#include "ROOT/TProcessExecutor.hxx"
+#include "TH1F.h"
+#include "TH2D.h"
+#include "TRandom3.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+const int kFills = 100000;
+
+// The task functions, for results of about `cells` bins or entries.
+std::function<TH1F *(unsigned int)> MakeTH1F(Long64_t cells)
+{
+   return [cells](unsigned int task) {
+      auto h = new TH1F("h1f", "h1f", cells, -5, 5);
+      TRandom3 rnd(task + 1);
+      for (int i = 0; i < kFills; ++i)
+         h->Fill(rnd.Gaus());
+      return h;
+   };
+}
+
+std::function<TH2D *(unsigned int)> MakeTH2D(Long64_t cells)
+{
+   const int nbins = std::sqrt(double(cells));
+   return [nbins](unsigned int task) {
+      auto h = new TH2D("h2d", "h2d", nbins, -5, 5, nbins, -5, 5);
+      TRandom3 rnd(task + 1);
+      for (int i = 0; i < kFills; ++i)
+         h->Fill(rnd.Gaus(), rnd.Gaus());
+      return h;
+   };
+}
+
+std::function<TTree *(unsigned int)> MakeTTree(Long64_t cells)
+{
+   return [cells](unsigned int task) {
+      auto tree = new TTree("t", "t");
+      tree->SetDirectory(nullptr);
+      double x, y;
+      tree->Branch("x", &x);
+      tree->Branch("y", &y);
+      TRandom3 rnd(task + 1);
+      for (Long64_t i = 0; i < cells; ++i) {
+         x = rnd.Gaus();
+         y = rnd.Rndm();
+         tree->Fill();
+      }
+      tree->ResetBranchAddresses();
+      return tree;
+   };
+}
+
+// Bin contents and entries, or entries and sum of x for trees.
+std::vector<double> Summary(TObject *obj)
+{
+   std::vector<double> summary;
+   if (auto hist = dynamic_cast<TH1 *>(obj)) {
+      summary.push_back(hist->GetEntries());
+      for (int bin = 0; bin < hist->GetNcells(); ++bin)
+         summary.push_back(hist->GetBinContent(bin));
+   } else if (auto tree = dynamic_cast<TTree *>(obj)) {
+      double x, sum = 0;
+      tree->SetBranchAddress("x", &x);
+      for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+         tree->GetEntry(entry);
+         sum += x;
+      }
+      tree->ResetBranchAddresses();
+      summary.push_back(tree->GetEntries());
+      summary.push_back(sum);
+   }
+   return summary;
+}
+
+bool SameSummary(const std::vector<double> &a, const std::vector<double> &b)
+{
+   if (a.size() != b.size())
+      return false;
+   for (size_t i = 0; i < a.size(); ++i)
+      // Sums of tree entries in a different order round differently.
+      if (std::abs(a[i] - b[i]) > 1e-9 * std::max(1., std::abs(a[i])))
+         return false;
+   return true;
+}
+
+// Median time of nrep runs of each transport; ERRORs if the results differ.
+template <class T>
+int Compare(const char *type, Long64_t cells, std::function<T *(unsigned int)> func, unsigned int nworkers, int nrep,
+            BenchmarkJSON &json)
+{
+   const char *transports[] = {"socket", "streamed", "inplace"};
+   std::vector<unsigned int> tasks(nworkers);
+   for (unsigned int t = 0; t < nworkers; ++t)
+      tasks[t] = t;
+   SharedResultExecutor shared(nworkers);
+
+   int ret = 0;
+   double times[3];
+   std::vector<double> summaries[3];
+   for (int k = 0; k < 3; ++k) {
+      std::vector<double> reps;
+      for (int rep = 0; rep < nrep; ++rep) {
+         T *result = nullptr;
+         TStopwatch timer;
+         if (k == 0) {
+            ROOT::TProcessExecutor pool(nworkers);
+            result = pool.MapReduce(func, tasks, MergeResults<T>);
+         } else {
+            result = shared.MapReduce(func, nworkers,
+                                      k == 1 ? SharedResultExecutor::kStreamed : SharedResultExecutor::kInPlace);
+         }
+         timer.Stop();
+         reps.push_back(timer.RealTime());
+         if (!result) {
+            printf("ERROR: %s of %lld cells: no result with the %s transport\n", type, cells, transports[k]);
+            return 1;
+         }
+         summaries[k] = Summary(result);
+         delete result;
+      }
+      times[k] = BenchmarkMedian(reps);
+   }
+   for (int k = 1; k < 3; ++k)
+      if (!SameSummary(summaries[0], summaries[k])) {
+         printf("ERROR: %s of %lld cells: the %s result differs from the socket one\n", type, cells, transports[k]);
+         ++ret;
+      }
+
+   printf("%-6s %12lld %12.4f %12.4f %12.4f\n", type, cells, times[0], times[1], times[2]);
+   json.BeginObject().Add("type", type).Add("cells", cells).Add("socket_s", times[0]).Add("streamed_s", times[1])
+      .Add("inplace_s", times[2]).EndObject();
+   return ret;
+}
+
+int main(int argc, char **argv)
+{
+   const unsigned int nworkers = std::max(1, argc > 1 ? atoi(argv[1]) : 4);
+   const Long64_t maxCells = argc > 2 ? atoll(argv[2]) : 10000000;
+   const int nrep = std::max(1, argc > 3 ? atoi(argv[3]) : 3);
+   const char *output = argc > 4 ? argv[4] : "sharedResults.json";
+
+   TH1::AddDirectory(false);
+
+   BenchmarkJSON json(output);
+   if (!json.IsOpen())
+      return 1;
+   json.BeginObject().Add("workers", nworkers).Add("fills", kFills).BeginArray("results");
+   printf("%-6s %12s %12s %12s %12s\n", "type", "cells", "socket [s]", "streamed [s]", "inplace [s]");
+
+   int ret = 0;
+   for (Long64_t cells = 10000; cells <= maxCells; cells *= 10) {
+      ret += Compare<TH1F>("TH1F", cells, MakeTH1F(cells), nworkers, nrep, json);
+      ret += Compare<TH2D>("TH2D", cells, MakeTH2D(cells), nworkers, nrep, json);
+      // A tree entry holds 16 bytes, where a bin of TH1F holds 4.
+      if (cells <= maxCells / 4)
+         ret += Compare<TTree>("TTree", cells, MakeTTree(cells), nworkers, nrep, json);
+   }
+   json.EndArray().EndObject();
+   return ret;
+}
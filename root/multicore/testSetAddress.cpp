@@ -6,6 +6,8 @@
 #include "TTree.h"
 #include "TTreeReader.h"
 
+#include "LockProfiler.h"
+
 #include <atomic>
 #include <iostream>
 #include <mutex>
@@ -31,6 +33,7 @@ int test_branch() {
   std::atomic<bool> retval(false);
 
   ROOT::EnableThreadSafety();
+  auto profiler = LockProfiler::InstallIfRequested();
 
   std::vector<std::thread> threads;
   for (int i = 0; i < kNThreads; ++i) {
@@ -84,6 +87,8 @@ int test_branch() {
 
   for (auto &&t : threads)
     t.join();
+  if (profiler)
+    profiler->WriteJSON("testSetAddress_locks.json");
 
   return retval;
 }
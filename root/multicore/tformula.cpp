@@ -1,6 +1,7 @@
 #include "TFormula.h"
 #include "TROOT.h"
 #include "TObject.h"
+#include "LockProfiler.h"
 #include <thread>
 #include <memory>
 #include <atomic>
@@ -14,6 +15,7 @@ int main()
 
  //Tell Root we want to be multi-threaded
  ROOT::EnableThreadSafety();
+ auto profiler = LockProfiler::InstallIfRequested();
  //When threading, also have to keep ROOT from logging all TObjects into a list
  TObject::SetObjectStat(false);
 
@@ -35,6 +37,8 @@ int main()
  for(auto& thread: threads) {
    thread.join();
  }
+ if (profiler)
+   profiler->WriteJSON("tformula_locks.json");
 
  return 0;
 }
@@ -0,0 +1,219 @@
+// Thread scaling of the multi-threaded workloads of ROOT, on a local,
+// self-generated input:
+//    processor  TTreeProcessorMT over the tree, TTreeReader per task
+//    mapreduce  TThreadExecutor::MapReduce of a CPU bound function
+//    getentry   TTree::GetEntry with IMT, i.e. parallel branch reading
+//    rdf        RDataFrame Filter / Define / Histo1D / Sum
+// Every workload runs with 1, 2, 4, ... threads up to the maximum, and the
+// maximum itself. For each thread count n it reports the median time of the
+// repetitions, the speed-up S = T(1) / T(n), the parallel efficiency S / n
+// and the serial fraction of Karp and Flatt, (1/S - 1/n) / (1 - 1/n): a
+// serial fraction growing with n means overheads, not serial code, are
+// limiting the scaling. The results of all thread counts must agree.
+//
+//    threadScaling [max threads] [entries] [repetitions] [output]
+//
+// The default maximum is the number of hardware threads. The results go to
+// the JSON file `output` and to stdout.
+
+#include "../../scripts/benchmarkresults.h"
+
+#include "ROOT/RDataFrame.hxx"
+#include "ROOT/TThreadExecutor.hxx"
+#include "ROOT/TTreeProcessorMT.hxx"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TROOT.h"
+#include "TRandom3.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const char *kFileName = "threadScaling.root";
+const char *kTreeName = "T";
+const int kNBranches = 16;
+
+void WriteTree(Long64_t nentries)
+{
+   TFile f(kFileName, "RECREATE");
+   TTree tree(kTreeName, "thread scaling");
+   TRandom3 rnd(1);
+   std::vector<std::vector<double>> vectors(kNBranches);
+   double x;
+   tree.Branch("x", &x);
+   for (int b = 0; b < kNBranches; ++b)
+      tree.Branch(("v" + std::to_string(b)).c_str(), &vectors[b]);
+   // Enough clusters for the largest thread counts.
+   tree.SetAutoFlush(std::max<Long64_t>(nentries / 256, 100));
+   for (Long64_t entry = 0; entry < nentries; ++entry) {
+      x = rnd.Gaus();
+      for (auto &v : vectors) {
+         v.resize(rnd.Integer(20));
+         for (auto &e : v)
+            e = rnd.Rndm();
+      }
+      tree.Fill();
+   }
+   tree.Write();
+}
+
+double Processor()
+{
+   ROOT::TTreeProcessorMT processor(kFileName, kTreeName);
+   std::mutex mutex;
+   double sum = 0;
+   processor.Process([&](TTreeReader &reader) {
+      TTreeReaderValue<double> x(reader, "x");
+      TTreeReaderValue<std::vector<double>> v(reader, "v0");
+      double local = 0;
+      while (reader.Next()) {
+         local += *x;
+         for (auto e : *v)
+            local += std::sqrt(e);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      sum += local;
+   });
+   return sum;
+}
+
+double MapReduce(unsigned int nthreads)
+{
+   ROOT::TThreadExecutor pool(nthreads);
+   const unsigned int ntasks = 256;
+   auto integrate = [](unsigned int task) {
+      // Midpoint rule of 4 / (1 + x^2) over this task's slice of [0, 1].
+      const int nsteps = 20000;
+      const double width = 1. / ntasks / nsteps;
+      double sum = 0;
+      for (int i = 0; i < nsteps; ++i) {
+         double x = (task * nsteps + i + 0.5) * width;
+         sum += 4. / (1. + x * x) * width;
+      }
+      return sum;
+   };
+   std::vector<unsigned int> tasks(ntasks);
+   for (unsigned int i = 0; i < ntasks; ++i)
+      tasks[i] = i;
+   return pool.MapReduce(integrate, tasks, [](const std::vector<double> &v) {
+      double sum = 0;
+      for (auto e : v)
+         sum += e;
+      return sum;
+   });
+}
+
+double GetEntry()
+{
+   TFile f(kFileName);
+   TTree *tree = nullptr;
+   f.GetObject(kTreeName, tree);
+   tree->SetImplicitMT(true);
+   Long64_t nbytes = 0;
+   const Long64_t nentries = tree->GetEntries();
+   for (Long64_t entry = 0; entry < nentries; ++entry)
+      nbytes += tree->GetEntry(entry);
+   return nbytes;
+}
+
+double DataFrame()
+{
+   ROOT::RDataFrame df(kTreeName, kFileName);
+   auto selected = df.Filter([](double x) { return x > -1; }, {"x"}).Define("s", [](const std::vector<double> &v) {
+      double s = 0;
+      for (auto e : v)
+         s += e * e;
+      return s;
+   }, {"v1"});
+   auto hist = selected.Histo1D({"h", "s", 100, 0, 20}, "s");
+   auto sum = selected.Sum<double>("s");
+   return *sum + hist->GetEntries();
+}
+
+struct Workload {
+   std::string fName;
+   std::function<double(unsigned int)> fRun;
+   double fTolerance; // relative, on the result
+};
+
+int main(int argc, char **argv)
+{
+   const unsigned int maxThreads = std::max(1, argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency());
+   const Long64_t nentries = argc > 2 ? atoll(argv[2]) : 200000;
+   const int nrep = std::max(1, argc > 3 ? atoi(argv[3]) : 3);
+   const char *output = argc > 4 ? argv[4] : "threadScaling.json";
+
+   WriteTree(nentries);
+
+   std::vector<unsigned int> threadCounts;
+   for (unsigned int n = 1; n < maxThreads; n *= 2)
+      threadCounts.push_back(n);
+   threadCounts.push_back(maxThreads);
+
+   // Sums in a different order round differently.
+   std::vector<Workload> workloads{{"processor", [](unsigned int) { return Processor(); }, 1e-9},
+                                   {"mapreduce", MapReduce, 1e-12},
+                                   {"getentry", [](unsigned int) { return GetEntry(); }, 0},
+                                   {"rdf", [](unsigned int) { return DataFrame(); }, 1e-9}};
+
+   // times[w][t], results[w][t]
+   std::vector<std::vector<double>> times(workloads.size()), results(workloads.size());
+   for (auto nthreads : threadCounts) {
+      ROOT::EnableImplicitMT(nthreads);
+      for (size_t w = 0; w < workloads.size(); ++w) {
+         double result = 0;
+         times[w].push_back(BenchmarkMedian(nrep, [&] {
+            TStopwatch timer;
+            result = workloads[w].fRun(nthreads);
+            timer.Stop();
+            return timer.RealTime();
+         }));
+         results[w].push_back(result);
+      }
+      ROOT::DisableImplicitMT();
+   }
+
+   BenchmarkJSON json(output);
+   if (!json.IsOpen())
+      return 1;
+   int ret = 0;
+   json.BeginObject().Add("entries", nentries).Add("hardware_threads", std::thread::hardware_concurrency())
+      .BeginArray("workloads");
+   printf("%-10s %8s %10s %9s %11s %16s\n", "workload", "threads", "time [s]", "speed-up", "efficiency",
+          "serial fraction");
+   for (size_t w = 0; w < workloads.size(); ++w) {
+      json.BeginObject().Add("workload", workloads[w].fName.c_str()).BeginArray("points");
+      for (size_t t = 0; t < threadCounts.size(); ++t) {
+         const double n = threadCounts[t];
+         const double speedup = times[w][t] > 0 ? times[w][0] / times[w][t] : 0;
+         const double efficiency = speedup / n;
+         const double serial = n > 1 && speedup > 0 ? (1. / speedup - 1. / n) / (1. - 1. / n) : 0;
+         printf("%-10s %8u %10.4f %9.2f %11.2f %16.3f\n", workloads[w].fName.c_str(), threadCounts[t], times[w][t],
+                speedup, efficiency, serial);
+         json.BeginObject().Add("threads", threadCounts[t]).Add("time_s", times[w][t]).Add("speedup", speedup)
+            .Add("efficiency", efficiency).Add("serial_fraction", serial).EndObject();
+         const double reference = results[w][0];
+         if (std::abs(results[w][t] - reference) > workloads[w].fTolerance * std::abs(reference)) {
+            printf("ERROR: %s with %u threads gives %.12g, with 1 thread %.12g\n", workloads[w].fName.c_str(),
+                   threadCounts[t], results[w][t], reference);
+            ++ret;
+         }
+      }
+      json.EndArray().EndObject();
+   }
+   json.EndArray().EndObject();
+   gSystem->Unlink(kFileName);
+   return ret;
+}
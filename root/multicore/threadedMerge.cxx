@@ -0,0 +1,210 @@
+// Merge time of TThreadedObject<TH1D> against the number of threads and the
+// histogram size, and the cost of finding the thread's slot when filling.
+//
+//    threadedMerge [max threads] [histograms] [repetitions] [output]
+//
+// For 1, 2, 4, ... threads up to the maximum, every thread fills its copies
+// of `histograms` TThreadedObject<TH1D> of 100 and 10000 bins, and of one of
+// 10000 * `histograms` bins, which are then merged:
+//    serial   TThreadedObject::Merge(), all slots into the first one in turn
+//    tree     Merge(ParallelMergeTObjects(pool)) of ThreadedMerge.h: pairwise
+//             tree reduction, log2(threads) rounds of parallel merges, in
+//             one pool for all histograms
+//    objects  the serial Merge() of the different histograms in parallel
+// All three must give the same bin contents.
+//
+// On the fill path, it times 20000 * `histograms` fills per thread through:
+//    arrow    h->Fill(x): TThreadedObject looks up the slot of the thread
+//    cached   auto local = h.Get() once per thread, then local->Fill(x)
+//    slots    slots.Get()->Fill(x) of ThreadSlots (ThreadedMerge.h)
+//
+// It reports the median time of the repetitions. The results go to the JSON
+// file `output` and to stdout.
+
+#include "ThreadedMerge.h"
+#include "../../scripts/benchmarkresults.h"
+
+#include "ROOT/TThreadExecutor.hxx"
+#include "ROOT/TThreadedObject.hxx"
+#include "TH1D.h"
+#include "TROOT.h"
+#include "TRandom3.h"
+#include "TStopwatch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Histos_t = std::vector<std::unique_ptr<ROOT::TThreadedObject<TH1D>>>;
+
+// Run func(thread) on nthreads new threads.
+template <class F>
+void RunThreads(unsigned int nthreads, F func)
+{
+   std::vector<std::thread> threads;
+   for (unsigned int t = 0; t < nthreads; ++t)
+      threads.emplace_back(func, t);
+   for (auto &thread : threads)
+      thread.join();
+}
+
+// The same contents for every strategy: thread t always draws from seed t + 1.
+Histos_t MakeHistos(unsigned int nthreads, int nhistos, int nbins)
+{
+   Histos_t histos;
+   for (int h = 0; h < nhistos; ++h) {
+      const std::string name = "h" + std::to_string(h);
+      histos.emplace_back(new ROOT::TThreadedObject<TH1D>(name.c_str(), name.c_str(), nbins, 0, 1));
+   }
+   const int nfills = std::max(1000, nbins / 10);
+   RunThreads(nthreads, [&](unsigned int t) {
+      TRandom3 rnd(t + 1);
+      for (auto &h : histos) {
+         auto local = h->Get();
+         for (int i = 0; i < nfills; ++i)
+            local->Fill(rnd.Rndm());
+      }
+   });
+   return histos;
+}
+
+// Merge with the given strategy; returns the merged histograms.
+std::vector<std::shared_ptr<TH1D>> Merge(Histos_t &histos, const char *strategy, unsigned int nthreads)
+{
+   std::vector<std::shared_ptr<TH1D>> merged(histos.size());
+   const std::string s = strategy;
+   if (s == "serial") {
+      for (size_t h = 0; h < histos.size(); ++h)
+         merged[h] = histos[h]->Merge();
+   } else if (s == "tree") {
+      ROOT::TThreadExecutor pool(nthreads);
+      auto mergeFunction = ParallelMergeTObjects<TH1D>(pool);
+      for (size_t h = 0; h < histos.size(); ++h)
+         merged[h] = histos[h]->Merge(mergeFunction);
+   } else {
+      std::vector<unsigned int> ids(histos.size());
+      for (size_t h = 0; h < histos.size(); ++h)
+         ids[h] = h;
+      ROOT::TThreadExecutor pool(nthreads);
+      pool.Foreach([&](unsigned int h) { merged[h] = histos[h]->Merge(); }, ids);
+   }
+   return merged;
+}
+
+bool SameContents(const TH1D &a, const TH1D &b)
+{
+   if (a.GetNbinsX() != b.GetNbinsX() || a.GetEntries() != b.GetEntries())
+      return false;
+   for (int bin = 0; bin <= a.GetNbinsX() + 1; ++bin)
+      if (a.GetBinContent(bin) != b.GetBinContent(bin))
+         return false;
+   return true;
+}
+
+// Time of nfills fills per thread through one of the slot lookups; the merged
+// histogram must hold all fills.
+double TimeFills(const char *lookup, unsigned int nthreads, int nfills, int &ret)
+{
+   const std::string l = lookup;
+   ROOT::TThreadedObject<TH1D> h("fill", "fill", 100, 0, 1);
+   ThreadSlots<TH1D> slots(TH1D("fill", "fill", 100, 0, 1));
+   TStopwatch timer;
+   RunThreads(nthreads, [&](unsigned int t) {
+      const double x = (t + 0.5) / nthreads;
+      if (l == "arrow") {
+         for (int i = 0; i < nfills; ++i)
+            h->Fill(x);
+      } else if (l == "cached") {
+         auto local = h.Get();
+         for (int i = 0; i < nfills; ++i)
+            local->Fill(x);
+      } else {
+         for (int i = 0; i < nfills; ++i)
+            slots.Get()->Fill(x);
+      }
+   });
+   timer.Stop();
+   auto merged = l == "slots" ? slots.Merge() : h.Merge();
+   if (!merged || merged->GetEntries() != double(nthreads) * nfills) {
+      printf("ERROR: %s fills with %u threads: %g entries instead of %g\n", lookup, nthreads,
+             merged ? merged->GetEntries() : 0., double(nthreads) * nfills);
+      ++ret;
+   }
+   return timer.RealTime();
+}
+
+int main(int argc, char **argv)
+{
+   const unsigned int maxThreads = std::max(1, argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency());
+   const int nhistos = std::max(1, argc > 2 ? atoi(argv[2]) : 100);
+   const int nrep = std::max(1, argc > 3 ? atoi(argv[3]) : 3);
+   const char *output = argc > 4 ? argv[4] : "threadedMerge.json";
+
+   ROOT::EnableThreadSafety();
+   TH1::AddDirectory(false);
+
+   std::vector<unsigned int> threadCounts;
+   for (unsigned int n = 1; n < maxThreads; n *= 2)
+      threadCounts.push_back(n);
+   threadCounts.push_back(maxThreads);
+
+   BenchmarkJSON json(output);
+   if (!json.IsOpen())
+      return 1;
+   int ret = 0;
+
+   // {bins, histograms}
+   const std::vector<std::pair<int, int>> sizes{{100, nhistos}, {10000, nhistos}, {10000 * nhistos, 1}};
+   const char *strategies[] = {"serial", "tree", "objects"};
+   json.BeginObject().Add("hardware_threads", std::thread::hardware_concurrency()).BeginArray("merge");
+   printf("%-8s %10s %10s %12s %12s %12s\n", "threads", "bins", "histos", "serial [s]", "tree [s]", "objects [s]");
+   for (size_t t = 0; t < threadCounts.size(); ++t) {
+      const unsigned int nthreads = threadCounts[t];
+      for (size_t s = 0; s < sizes.size(); ++s) {
+         double times[3];
+         std::vector<std::shared_ptr<TH1D>> results[3];
+         for (int k = 0; k < 3; ++k) {
+            times[k] = BenchmarkMedian(nrep, [&] {
+               auto histos = MakeHistos(nthreads, sizes[s].second, sizes[s].first);
+               TStopwatch timer;
+               results[k] = Merge(histos, strategies[k], nthreads);
+               timer.Stop();
+               return timer.RealTime();
+            });
+         }
+         for (int k = 1; k < 3; ++k)
+            for (size_t h = 0; h < results[0].size(); ++h)
+               if (!results[k][h] || !SameContents(*results[0][h], *results[k][h])) {
+                  printf("ERROR: %s merge of %d bins with %u threads differs from the serial one\n", strategies[k],
+                         sizes[s].first, nthreads);
+                  ++ret;
+                  break;
+               }
+         printf("%-8u %10d %10d %12.4f %12.4f %12.4f\n", nthreads, sizes[s].first, sizes[s].second, times[0],
+                times[1], times[2]);
+         json.BeginObject().Add("threads", nthreads).Add("bins", sizes[s].first).Add("histograms", sizes[s].second)
+            .Add("serial_s", times[0]).Add("tree_s", times[1]).Add("objects_s", times[2]).EndObject();
+      }
+   }
+
+   const int nfills = 20000 * nhistos;
+   const char *lookups[] = {"arrow", "cached", "slots"};
+   json.EndArray().Add("fills_per_thread", nfills).BeginArray("fill");
+   printf("\n%-8s %14s %14s %14s\n", "threads", "arrow [ns]", "cached [ns]", "slots [ns]");
+   for (size_t t = 0; t < threadCounts.size(); ++t) {
+      const unsigned int nthreads = threadCounts[t];
+      double ns[3];
+      for (int k = 0; k < 3; ++k) {
+         ns[k] = 1e9 * BenchmarkMedian(nrep, [&] { return TimeFills(lookups[k], nthreads, nfills, ret); }) / nfills;
+      }
+      printf("%-8u %14.2f %14.2f %14.2f\n", nthreads, ns[0], ns[1], ns[2]);
+      json.BeginObject().Add("threads", nthreads).Add("arrow_ns", ns[0]).Add("cached_ns", ns[1])
+         .Add("slots_ns", ns[2]).EndObject();
+   }
+   json.EndArray().EndObject();
+   return ret;
+}
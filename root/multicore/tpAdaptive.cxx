@@ -0,0 +1,112 @@
+// TTreeProcessorMT against AdaptivePartitioner.h on trees with skewed
+// cluster sizes and skewed per-entry cost (generate_skewed_tree of
+// generate_imt_tree.C): a few huge clusters, thousands of tiny ones, and a
+// mix of both. The work per entry is a loop over the "hits" vector; both
+// must give the same sum.
+//
+//    tpAdaptive [threads] [entries] [repetitions] [output]
+//
+// For each layout it reports the median time of the repetitions with each
+// partitioning and the task size distribution of the adaptive one. The
+// results go to the JSON file `output` and to stdout.
+
+#include "AdaptivePartitioner.h"
+#include "generate_imt_tree.C"
+#include "../../scripts/benchmarkresults.h"
+
+#include "ROOT/TTreeProcessorMT.hxx"
+#include "TROOT.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+const char *kSkewedTree = "TreeIMT";
+
+// The work on one range of entries.
+double SumRange(TTreeReader &reader)
+{
+   TTreeReaderValue<Float_t> x(reader, "x");
+   TTreeReaderValue<std::vector<Double_t>> hits(reader, "hits");
+   double sum = 0;
+   while (reader.Next()) {
+      for (auto h : *hits)
+         for (int k = 1; k <= 50; ++k)
+            sum += std::sqrt(h * k) / k;
+      sum += *x;
+   }
+   return sum;
+}
+
+int main(int argc, char **argv)
+{
+   const unsigned int nthreads = std::max(1, argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency());
+   const int nentries = argc > 2 ? atoi(argv[2]) : 200000;
+   const int nrep = std::max(1, argc > 3 ? atoi(argv[3]) : 3);
+   const char *output = argc > 4 ? argv[4] : "tpAdaptive.json";
+
+   ROOT::EnableImplicitMT(nthreads);
+
+   BenchmarkJSON json(output);
+   if (!json.IsOpen())
+      return 1;
+   json.BeginObject().Add("threads", nthreads).Add("entries", nentries).BeginArray("layouts");
+
+   int ret = 0;
+   const char *layouts[] = {"huge", "tiny", "mixed"};
+   for (int l = 0; l < 3; ++l) {
+      const std::string filename = std::string("tpAdaptive_") + layouts[l] + ".root";
+      generate_skewed_tree(filename.c_str(), layouts[l], nentries);
+
+      std::mutex mutex;
+      double sums[2] = {0, 0};
+      double times[2];
+      AdaptivePartitioner partitioner(kSkewedTree, {filename});
+      for (int mode = 0; mode < 2; ++mode) {
+         std::vector<double> reps;
+         for (int rep = 0; rep < nrep; ++rep) {
+            sums[mode] = 0;
+            auto process = [&](TTreeReader &reader) {
+               double sum = SumRange(reader);
+               std::lock_guard<std::mutex> lock(mutex);
+               sums[mode] += sum;
+            };
+            TStopwatch timer;
+            if (mode == 0) {
+               ROOT::TTreeProcessorMT processor(filename, kSkewedTree);
+               processor.Process(process);
+            } else if (!partitioner.Process(process, nthreads)) {
+               return 1;
+            }
+            timer.Stop();
+            reps.push_back(timer.RealTime());
+         }
+         times[mode] = BenchmarkMedian(reps);
+      }
+
+      printf("%s clusters: TTreeProcessorMT %.3f s, adaptive %.3f s\n", layouts[l], times[0], times[1]);
+      partitioner.PrintReport();
+      if (std::abs(sums[0] - sums[1]) > 1e-9 * std::abs(sums[0])) {
+         printf("ERROR: %s clusters: TTreeProcessorMT sums to %.12g, adaptive to %.12g\n", layouts[l], sums[0],
+                sums[1]);
+         ++ret;
+      }
+
+      std::vector<double> entries;
+      for (auto &task : partitioner.GetTasks())
+         entries.push_back(task.fLast - task.fFirst);
+      json.BeginObject().Add("layout", layouts[l]).Add("clusters", partitioner.GetNClusters())
+         .Add("processor_s", times[0]).Add("adaptive_s", times[1]).Add("tasks", entries.size())
+         .Add("median_task_entries", BenchmarkMedian(entries)).EndObject();
+      gSystem->Unlink(filename.c_str());
+   }
+   json.EndArray().EndObject();
+   return ret;
+}
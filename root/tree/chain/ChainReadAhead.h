@@ -0,0 +1,150 @@
+#ifndef ROOTTEST_CHAINREADAHEAD_H
+#define ROOTTEST_CHAINREADAHEAD_H
+
+// Read-ahead for a TChain: while the chain reads one file, a background thread
+// opens the next one and reads the first cluster of the branches the
+// TTreeCache learned, such that the switch to the next file finds its
+// metadata and first baskets in the page cache. On every switch the learned
+// branch set is handed to the new file's TTreeCache, which then does not
+// need to learn again.
+//
+//    TChain chain("tester");
+//    ...
+//    chain.SetCacheSize(10000000);
+//    ChainReadAhead readAhead(&chain);
+//    for (Long64_t entry = 0; readAhead.GetEntry(entry) > 0; ++entry)
+//       ...
+//
+// GetEntry() is TChain::GetEntry plus noticing the end of the learning
+// phase; the branch set of a chain whose cache never finished learning is
+// empty and nothing is prefetched. The chain's notify object is forwarded to.
+
+#include "TChain.h"
+#include "TChainElement.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TROOT.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ChainReadAhead : public TObject {
+public:
+   ChainReadAhead(TChain *chain) : fChain(chain), fPrevNotify(chain->GetNotify()), fPrefetched(-1), fSwitches(0)
+   {
+      ROOT::EnableThreadSafety();
+      fChain->SetNotify(this);
+   }
+
+   ~ChainReadAhead()
+   {
+      Wait();
+      if (fChain->GetNotify() == this)
+         fChain->SetNotify(fPrevNotify);
+   }
+
+   Int_t GetEntry(Long64_t entry, Int_t getall = 0)
+   {
+      Int_t nbytes = fChain->GetEntry(entry, getall);
+      if (fBranches.empty() && Learn())
+         Prefetch(fChain->GetTreeNumber() + 1);
+      return nbytes;
+   }
+
+   // The learned branch set, empty while the cache is learning.
+   const std::vector<std::string> &GetBranches() const { return fBranches; }
+   // Index in the chain of the last file prefetched, -1 if none.
+   Int_t GetPrefetched() const { return fPrefetched; }
+   // File switches that found their branch set learned.
+   Int_t GetSwitches() const { return fSwitches; }
+
+   Bool_t Notify() override
+   {
+      // Called by the chain once it has opened a new file.
+      Wait();
+      if (!fBranches.empty()) {
+         TTreeCache *cache = GetCache();
+         if (cache) {
+            if (cache->IsLearning()) {
+               for (auto &name : fBranches)
+                  fChain->AddBranchToCache(name.c_str(), true);
+               fChain->StopCacheLearningPhase();
+            }
+            ++fSwitches;
+         }
+         Prefetch(fChain->GetTreeNumber() + 1);
+      }
+      return fPrevNotify ? fPrevNotify->Notify() : kTRUE;
+   }
+
+private:
+   ChainReadAhead(const ChainReadAhead &) = delete;
+   ChainReadAhead &operator=(const ChainReadAhead &) = delete;
+
+   TTreeCache *GetCache() const
+   {
+      TFile *file = fChain->GetCurrentFile();
+      return file ? dynamic_cast<TTreeCache *>(fChain->GetReadCache(file)) : nullptr;
+   }
+
+   // Record the branch set once the cache has learned it.
+   bool Learn()
+   {
+      TTreeCache *cache = GetCache();
+      if (!cache || cache->IsLearning() || !cache->GetCachedBranches())
+         return false;
+      TObjArray *branches = cache->GetCachedBranches();
+      for (Int_t i = 0; i < branches->GetEntriesFast(); ++i)
+         fBranches.push_back(branches->UncheckedAt(i)->GetName());
+      return !fBranches.empty();
+   }
+
+   void Prefetch(Int_t treeNumber)
+   {
+      auto element = (TChainElement *)fChain->GetListOfFiles()->At(treeNumber);
+      if (!element || treeNumber == fPrefetched)
+         return;
+      fPrefetched = treeNumber;
+      std::string fileName = element->GetTitle();
+      std::string treeName = element->GetName();
+      Long64_t cacheSize = fChain->GetCacheSize();
+      std::vector<std::string> branches = fBranches;
+      fThread = std::thread([fileName, treeName, cacheSize, branches]() {
+         std::unique_ptr<TFile> file(TFile::Open(fileName.c_str()));
+         TTree *tree = nullptr;
+         if (file && !file->IsZombie())
+            file->GetObject(treeName.c_str(), tree);
+         if (!tree || tree->GetEntries() == 0)
+            return;
+         tree->SetCacheSize(cacheSize > 0 ? cacheSize : -1);
+         for (auto &name : branches)
+            tree->AddBranchToCache(name.c_str(), true);
+         tree->StopCacheLearningPhase();
+         // Reading entry 0 of the cached branches fills the cache with the
+         // first cluster.
+         for (auto &name : branches)
+            if (TBranch *branch = tree->GetBranch(name.c_str()))
+               branch->GetEntry(0);
+      });
+   }
+
+   void Wait()
+   {
+      if (fThread.joinable())
+         fThread.join();
+   }
+
+   TChain *fChain;
+   TObject *fPrevNotify;
+   std::vector<std::string> fBranches;
+   std::thread fThread;
+   Int_t fPrefetched;
+   Int_t fSwitches;
+};
+
+#endif // ROOTTEST_CHAINREADAHEAD_H
@@ -0,0 +1,143 @@
+#ifndef ROOTTEST_ENTRYLISTPREFETCH_H
+#define ROOTTEST_ENTRYLISTPREFETCH_H
+
+// Iteration over the entries of a TEntryList that prefetches at basket
+// granularity: only the baskets of the active branches that hold a selected
+// entry are fetched, with one vectored read per window of windowBytes, and
+// only those are unzipped. TTreeCache instead fetches every cluster holding
+// a selected entry, which for sparse selections is most of the file.
+//
+//    tree->SetBranchStatus(...);              // the branches to read
+//    EntryListPrefetch prefetch(tree, list);
+//    Long64_t entry;
+//    while ((entry = prefetch.Next()) >= 0)
+//       tree->GetEntry(entry);
+//
+// The tree's TTreeCache is disabled while the prefetcher exists, and set
+// back to its former size afterwards; the baskets are served by a
+// TFileCacheRead it installs as the file's default cache.
+// Works on a TTree, not on a TChain, with entry lists on the tree itself.
+
+#include "TBranch.h"
+#include "TEntryList.h"
+#include "TFile.h"
+#include "TFileCacheRead.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+class EntryListPrefetch {
+public:
+   EntryListPrefetch(TTree *tree, TEntryList *list, Int_t windowBytes = 16000000)
+      : fTree(tree), fFile(tree->GetCurrentFile()), fCache(nullptr), fTreeCacheSize(tree->GetCacheSize()),
+        fWindowBytes(windowBytes), fNext(0), fWindowEnd(0), fBaskets(0), fBytes(0), fReads(0)
+   {
+      for (Long64_t i = 0; i < list->GetN(); ++i)
+         fEntries.push_back(list->GetEntry(i));
+      std::sort(fEntries.begin(), fEntries.end());
+
+      TObjArray *leaves = tree->GetListOfLeaves();
+      for (Int_t i = 0; i < leaves->GetEntriesFast(); ++i) {
+         TBranch *branch = ((TLeaf *)leaves->UncheckedAt(i))->GetBranch();
+         if (branch->TestBit(kDoNotProcess) || std::find(fBranches.begin(), fBranches.end(), branch) != fBranches.end())
+            continue;
+         fBranches.push_back(branch);
+         fLastBasket.push_back(-1);
+      }
+
+      fTree->SetCacheSize(0);
+      fCache = new TFileCacheRead(fFile, windowBytes);
+   }
+
+   ~EntryListPrefetch()
+   {
+      if (fFile->GetCacheRead() == fCache)
+         fFile->SetCacheRead(nullptr);
+      delete fCache;
+      if (fTreeCacheSize > 0)
+         fTree->SetCacheSize(fTreeCacheSize);
+   }
+
+   // The next selected entry, with its baskets prefetched; -1 at the end.
+   Long64_t Next()
+   {
+      if (fNext >= fEntries.size())
+         return -1;
+      if (fNext == fWindowEnd)
+         PrefetchWindow();
+      return fEntries[fNext++];
+   }
+
+   // Baskets and bytes prefetched, and the number of windows read.
+   Long64_t GetBaskets() const { return fBaskets; }
+   Long64_t GetBytes() const { return fBytes; }
+   Long64_t GetWindows() const { return fReads; }
+
+private:
+   EntryListPrefetch(const EntryListPrefetch &) = delete;
+   EntryListPrefetch &operator=(const EntryListPrefetch &) = delete;
+
+   // Register the baskets of the selected entries from fNext on, until the
+   // window is full; a window holds at least one entry.
+   void PrefetchWindow()
+   {
+      fCache->Prefetch(0, 0); // reset
+      Long64_t bytes = 0;
+      size_t end = fNext;
+      std::vector<std::pair<size_t, Int_t>> needed; // branch, basket
+      for (; end < fEntries.size(); ++end) {
+         needed.clear();
+         Long64_t entryBytes = 0;
+         for (size_t b = 0; b < fBranches.size(); ++b) {
+            Int_t basket = FindBasket(fBranches[b], fEntries[end]);
+            if (basket >= 0 && basket != fLastBasket[b]) {
+               needed.emplace_back(b, basket);
+               entryBytes += fBranches[b]->GetBasketBytes()[basket];
+            }
+         }
+         if (end > fNext && bytes + entryBytes > fWindowBytes)
+            break;
+         for (auto &n : needed) {
+            TBranch *branch = fBranches[n.first];
+            fLastBasket[n.first] = n.second;
+            // The last basket can still be in memory, without a seek.
+            Long64_t seek = branch->GetBasketSeek(n.second);
+            if (!seek)
+               continue;
+            fCache->Prefetch(seek, branch->GetBasketBytes()[n.second]);
+            ++fBaskets;
+            fBytes += branch->GetBasketBytes()[n.second];
+         }
+         bytes += entryBytes;
+      }
+      fWindowEnd = end;
+      if (bytes)
+         ++fReads;
+   }
+
+   static Int_t FindBasket(TBranch *branch, Long64_t entry)
+   {
+      const Long64_t *first = branch->GetBasketEntry();
+      return std::upper_bound(first, first + branch->GetWriteBasket(), entry) - first - 1;
+   }
+
+   TTree *fTree;
+   TFile *fFile;
+   TFileCacheRead *fCache;
+   Long64_t fTreeCacheSize; // restored on destruction
+   Int_t fWindowBytes;
+   std::vector<Long64_t> fEntries;
+   std::vector<TBranch *> fBranches;
+   std::vector<Int_t> fLastBasket; // per branch, last prefetched
+   size_t fNext;
+   size_t fWindowEnd;
+   Long64_t fBaskets;
+   Long64_t fBytes;
+   Long64_t fReads;
+};
+
+#endif // ROOTTEST_ENTRYLISTPREFETCH_H
@@ -0,0 +1,131 @@
+#ifndef ROOTTEST_FRIENDALIGNMENT_H
+#define ROOTTEST_FRIENDALIGNMENT_H
+
+// Alignment map of a friend joined through an index: the friend entry of
+// every main entry, computed once by sorting the (major, minor) keys of both
+// trees with ParIndexBuilder and joining them, i.e. with sequential reads
+// only. Reading through the map then loads the friend entry directly instead
+// of looking it up in the friend's TTreeIndex, and tells the friend's
+// TTreeCache the range of friend entries the next window of main entries
+// maps to, such that the friend is read in large, mostly sequential chunks.
+//
+//    FriendAlignment align(mainTree, friendTree, "run", "event");
+//    for (Long64_t entry = 0; entry < mainTree->GetEntries(); ++entry)
+//       align.GetEntry(entry);  // main entry, and friend entry if any
+//
+// The friend must not also be attached to the main tree with AddFriend.
+// Both trees are either TChains or trees at the top directory of a file.
+// Main entries without a friend entry map to -1, friend entries matching
+// several main entries are shared, and if the friend has duplicate keys the
+// lowest friend entry is used, as for TTree::GetEntryNumberWithIndex.
+
+#include "../index/ParallelIndex.h"
+
+#include "TChain.h"
+#include "TChainElement.h"
+#include "TObjArray.h"
+
+class FriendAlignment {
+public:
+   FriendAlignment(TTree *mainTree, TTree *friendTree, const char *major, const char *minor = "0",
+                   Long64_t window = 10000, unsigned int nthreads = 0)
+      : fMain(mainTree), fFriend(friendTree), fWindow(window > 0 ? window : 1), fWindowStart(-1), fMissing(0),
+        fMonotonic(0), fValid(false)
+   {
+      std::vector<ParIndexRecord> mainKeys, friendKeys;
+      ParIndexBuilder mainBuilder(mainTree->GetName(), GetFiles(mainTree), major, minor);
+      mainBuilder.SetUnique(false);
+      ParIndexBuilder friendBuilder(friendTree->GetName(), GetFiles(friendTree), major, minor);
+      if (!mainBuilder.Build(mainKeys, nthreads) || !friendBuilder.Build(friendKeys, nthreads))
+         return;
+
+      // Join the two sorted key lists.
+      fMap.assign(mainBuilder.GetEntries(), -1);
+      size_t f = 0;
+      for (auto &rec : mainKeys) {
+         while (f < friendKeys.size() &&
+                (friendKeys[f].fMajor < rec.fMajor ||
+                 (friendKeys[f].fMajor == rec.fMajor && friendKeys[f].fMinor < rec.fMinor)))
+            ++f;
+         if (f < friendKeys.size() && friendKeys[f].fMajor == rec.fMajor && friendKeys[f].fMinor == rec.fMinor)
+            fMap[rec.fEntry] = friendKeys[f].fEntry;
+         else
+            ++fMissing;
+      }
+      for (size_t i = 1; i < fMap.size(); ++i)
+         if (fMap[i] >= fMap[i - 1])
+            ++fMonotonic;
+
+      fFriend->SetCacheSize();
+      fValid = true;
+   }
+
+   bool IsValid() const { return fValid; }
+
+   // The friend entry of the main entry, -1 if none.
+   Long64_t GetFriendEntry(Long64_t entry) const
+   {
+      return entry >= 0 && entry < (Long64_t)fMap.size() ? fMap[entry] : -1;
+   }
+
+   // Load the main entry and its friend entry; returns the bytes read, as
+   // TTree::GetEntry.
+   Int_t GetEntry(Long64_t entry, Int_t getall = 0)
+   {
+      Int_t nbytes = fMain->GetEntry(entry, getall);
+      Long64_t friendEntry = GetFriendEntry(entry);
+      if (friendEntry < 0)
+         return nbytes;
+      if (fWindowStart < 0 || entry < fWindowStart || entry >= fWindowStart + fWindow)
+         SetWindow(entry);
+      return nbytes + fFriend->GetEntry(friendEntry, getall);
+   }
+
+   Long64_t GetMissing() const { return fMissing; }
+   // Fraction of consecutive main entries whose friend entries do not
+   // decrease: 1 for aligned trees.
+   double GetMonotonicFraction() const { return fMap.size() > 1 ? fMonotonic / (fMap.size() - 1.) : 1.; }
+
+private:
+   static std::vector<std::string> GetFiles(TTree *tree)
+   {
+      std::vector<std::string> files;
+      if (auto chain = dynamic_cast<TChain *>(tree)) {
+         TObjArray *elements = chain->GetListOfFiles();
+         for (Int_t i = 0; i < elements->GetEntriesFast(); ++i)
+            files.push_back(elements->UncheckedAt(i)->GetTitle());
+      } else if (tree->GetCurrentFile()) {
+         files.push_back(tree->GetCurrentFile()->GetName());
+      }
+      return files;
+   }
+
+   // Restrict the friend's cache to the friend entries the window of main
+   // entries starting at entry maps to.
+   void SetWindow(Long64_t entry)
+   {
+      fWindowStart = entry;
+      Long64_t first = -1, last = -1;
+      Long64_t end = std::min(entry + fWindow, (Long64_t)fMap.size());
+      for (Long64_t i = entry; i < end; ++i) {
+         if (fMap[i] < 0)
+            continue;
+         if (first < 0 || fMap[i] < first)
+            first = fMap[i];
+         if (fMap[i] > last)
+            last = fMap[i];
+      }
+      fFriend->SetCacheEntryRange(first, last + 1);
+   }
+
+   TTree *fMain;
+   TTree *fFriend;
+   std::vector<Long64_t> fMap;
+   Long64_t fWindow;
+   Long64_t fWindowStart;
+   Long64_t fMissing;
+   Long64_t fMonotonic;
+   bool fValid;
+};
+
+#endif // ROOTTEST_FRIENDALIGNMENT_H
@@ -0,0 +1,479 @@
+#ifndef ROOTTEST_PARALLELINDEX_H
+#define ROOTTEST_PARALLELINDEX_H
+
+// Sorted-merge build of a (major, minor) -> entry index over a chain, for
+// chains too large for TTreeIndex's single-threaded, all-in-memory build.
+//
+// The chain is cut into chunks of whole clusters. Each chunk's keys are read
+// and sorted by its own task (with IMT in a thread pool); sorted chunks are
+// then merged. With an output file, every sorted chunk is spilled next to it
+// and the merge streams from the spills into the output, such that only the
+// chunks being sorted need to be held in memory.
+//
+// The index file is a header followed by the (major, minor, entry) records
+// sorted by key, all native Long64_t; ParIndexFile maps it into memory and
+// looks keys up with a binary search.
+//
+//    ParIndexBuilder builder("T", files, "run", "event");
+//    builder.Build("chain.idx", 8);   // 8 threads
+//    ParIndexFile index("chain.idx");
+//    Long64_t entry = index.GetEntryNumberWithIndex(run, event);
+//
+// Keys are evaluated with TTreeFormula::EvalInstance64, so major and minor can
+// be any integer branch or expression, as for TTree::BuildIndex. Unlike
+// TTreeIndex, duplicate keys keep the lowest entry number, unless
+// SetUnique(false) keeps all of them, ordered by entry.
+
+#include "RConfigure.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
+
+#ifdef R__USE_IMT
+#include "ROOT/TThreadExecutor.hxx"
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+struct ParIndexRecord {
+   Long64_t fMajor;
+   Long64_t fMinor;
+   Long64_t fEntry;
+
+   bool operator<(const ParIndexRecord &other) const
+   {
+      if (fMajor != other.fMajor)
+         return fMajor < other.fMajor;
+      if (fMinor != other.fMinor)
+         return fMinor < other.fMinor;
+      return fEntry < other.fEntry;
+   }
+};
+
+struct ParIndexHeader {
+   char fMagic[8];      // "RTPIDX1"
+   Long64_t fNRecords;
+   Long64_t fNEntries;  // of the chain
+   Long64_t fReserved;
+};
+
+const char kParIndexMagic[8] = "RTPIDX1";
+
+// A range of entries of one file of the chain, made of whole clusters.
+struct ParIndexChunk {
+   int fFile;
+   Long64_t fFirst;   // in the file's tree
+   Long64_t fLast;    // exclusive
+   Long64_t fOffset;  // of the file's first entry in the chain
+};
+
+class ParIndexBuilder {
+public:
+   ParIndexBuilder(const char *treeName, const std::vector<std::string> &files, const char *major,
+                   const char *minor = "0")
+      : fTreeName(treeName), fFiles(files), fMajor(major), fMinor(minor), fChunkEntries(1000000), fUnique(true),
+        fNEntries(0)
+   {
+   }
+
+   // Upper bound of the entries per chunk, i.e. of the records a task sorts.
+   void SetChunkEntries(Long64_t n) { fChunkEntries = n > 0 ? n : 1; }
+   // Whether duplicate keys are dropped, keeping their lowest entry.
+   void SetUnique(bool unique) { fUnique = unique; }
+
+   Long64_t GetEntries() const { return fNEntries; }
+   size_t GetNChunks() const { return fChunks.size(); }
+
+   // Build the index into memory. nthreads = 0 uses the default pool size.
+   bool Build(std::vector<ParIndexRecord> &index, unsigned int nthreads = 0)
+   {
+      std::vector<std::vector<ParIndexRecord>> sorted;
+      if (!MakeChunks() || !SortChunks(nthreads, sorted, ""))
+         return false;
+
+      std::vector<ParIndexSource *> sources;
+      for (auto &chunk : sorted)
+         sources.push_back(new ParIndexSource(&chunk));
+      index.clear();
+      index.reserve(fNEntries);
+      Merge(sources, [&index](const ParIndexRecord &rec) { index.push_back(rec); });
+      return true;
+   }
+
+   // Build the index into the file output, spilling the sorted chunks.
+   bool Build(const char *output, unsigned int nthreads = 0)
+   {
+      if (!MakeChunks())
+         return false;
+      std::vector<std::vector<ParIndexRecord>> unused;
+      const bool ok = SortChunks(nthreads, unused, output) && WriteIndex(output);
+      // Whichever chunks were spilled, also when others failed.
+      for (size_t c = 0; c < fChunks.size(); ++c)
+         gSystem->Unlink(SpillName(output, c));
+      return ok;
+   }
+
+private:
+   static constexpr size_t kBufferRecords = 1 << 16;
+
+   // A sorted chunk being merged, either in memory or spilled to a file.
+   class ParIndexSource {
+   public:
+      ParIndexSource(const std::vector<ParIndexRecord> *chunk) : fChunk(chunk), fFile(nullptr), fPos(0) {}
+      ParIndexSource(FILE *file) : fChunk(nullptr), fFile(file), fPos(0) { fBuffer.reserve(kBufferRecords); }
+      ~ParIndexSource()
+      {
+         if (fFile)
+            fclose(fFile);
+      }
+
+      // Whether there is a current record; Next() advances.
+      bool Valid()
+      {
+         if (fChunk)
+            return fPos < fChunk->size();
+         if (fPos < fBuffer.size())
+            return true;
+         fBuffer.resize(kBufferRecords);
+         fBuffer.resize(fread(fBuffer.data(), sizeof(ParIndexRecord), kBufferRecords, fFile));
+         fPos = 0;
+         return !fBuffer.empty();
+      }
+      const ParIndexRecord &Current() const { return fChunk ? (*fChunk)[fPos] : fBuffer[fPos]; }
+      void Next() { ++fPos; }
+
+   private:
+      const std::vector<ParIndexRecord> *fChunk;
+      FILE *fFile;
+      std::vector<ParIndexRecord> fBuffer;
+      size_t fPos;
+   };
+
+   static TString SpillName(const char *output, size_t chunk) { return TString::Format("%s.chunk%zu", output, chunk); }
+
+   // Cut the chain into chunks of whole clusters of at most fChunkEntries
+   // entries, unless a single cluster is larger.
+   bool MakeChunks()
+   {
+      fChunks.clear();
+      fNEntries = 0;
+      for (size_t f = 0; f < fFiles.size(); ++f) {
+         std::unique_ptr<TFile> file(TFile::Open(fFiles[f].c_str()));
+         TTree *tree = nullptr;
+         if (file && !file->IsZombie())
+            file->GetObject(fTreeName.Data(), tree);
+         if (!tree) {
+            Error("ParIndexBuilder", "Cannot read tree %s from %s", fTreeName.Data(), fFiles[f].c_str());
+            return false;
+         }
+         const Long64_t nentries = tree->GetEntries();
+         auto clusters = tree->GetClusterIterator(0);
+         Long64_t first = 0;
+         Long64_t start;
+         while ((start = clusters()) < nentries) {
+            Long64_t end = clusters.GetNextEntry();
+            if (end - first > fChunkEntries && start > first) {
+               fChunks.push_back({(int)f, first, start, fNEntries});
+               first = start;
+            }
+         }
+         if (nentries > first)
+            fChunks.push_back({(int)f, first, nentries, fNEntries});
+         fNEntries += nentries;
+      }
+      return true;
+   }
+
+   // Read and sort the keys of one chunk.
+   bool SortChunk(const ParIndexChunk &chunk, std::vector<ParIndexRecord> &records)
+   {
+      std::unique_ptr<TFile> file(TFile::Open(fFiles[chunk.fFile].c_str()));
+      TTree *tree = nullptr;
+      if (file && !file->IsZombie())
+         file->GetObject(fTreeName.Data(), tree);
+      if (!tree)
+         return false;
+      TTreeFormula major("ParIndexMajor", fMajor, tree);
+      TTreeFormula minor("ParIndexMinor", fMinor, tree);
+      if (!major.GetNdim() || !minor.GetNdim()) {
+         Error("ParIndexBuilder", "Cannot evaluate %s and %s", fMajor.Data(), fMinor.Data());
+         return false;
+      }
+      tree->SetCacheSize();
+      tree->SetCacheEntryRange(chunk.fFirst, chunk.fLast);
+      for (auto name : {fMajor.Data(), fMinor.Data()})
+         if (tree->GetBranch(name))
+            tree->AddBranchToCache(name, true);
+      tree->StopCacheLearningPhase();
+
+      records.resize(chunk.fLast - chunk.fFirst);
+      for (Long64_t entry = chunk.fFirst; entry < chunk.fLast; ++entry) {
+         tree->LoadTree(entry);
+         major.GetNdata();
+         minor.GetNdata();
+         records[entry - chunk.fFirst] = {major.EvalInstance64(), minor.EvalInstance64(), chunk.fOffset + entry};
+      }
+      std::sort(records.begin(), records.end());
+      return true;
+   }
+
+   // Sort all chunks; spill them next to output if given, else keep them in
+   // sorted.
+   bool SortChunks(unsigned int nthreads, std::vector<std::vector<ParIndexRecord>> &sorted, const char *output)
+   {
+      const bool spill = output && *output;
+      if (!spill)
+         sorted.resize(fChunks.size());
+      std::vector<int> status(fChunks.size(), 0);
+      auto sortOne = [&](unsigned int c) {
+         std::vector<ParIndexRecord> local;
+         auto &records = spill ? local : sorted[c];
+         if (!SortChunk(fChunks[c], records))
+            return;
+         if (spill) {
+            auto name = SpillName(output, c);
+            FILE *out = fopen(name.Data(), "wb");
+            if (!out)
+               return;
+            bool written = fwrite(records.data(), sizeof(ParIndexRecord), records.size(), out) == records.size();
+            if (fclose(out) != 0 || !written)
+               return;
+         }
+         status[c] = 1;
+      };
+
+#ifdef R__USE_IMT
+      std::vector<unsigned int> ids(fChunks.size());
+      for (size_t c = 0; c < ids.size(); ++c)
+         ids[c] = c;
+      ROOT::EnableThreadSafety();
+      ROOT::TThreadExecutor pool(nthreads);
+      pool.Foreach(sortOne, ids);
+#else
+      (void)nthreads;
+      for (size_t c = 0; c < fChunks.size(); ++c)
+         sortOne(c);
+#endif
+
+      for (size_t c = 0; c < fChunks.size(); ++c) {
+         if (!status[c]) {
+            Error("ParIndexBuilder", "Cannot sort chunk %zu (entries %lld to %lld of %s)", c, fChunks[c].fFirst,
+                  fChunks[c].fLast, fFiles[fChunks[c].fFile].c_str());
+            return false;
+         }
+      }
+      return true;
+   }
+
+   // Merge the spilled chunks into output. On error, output is removed.
+   bool WriteIndex(const char *output)
+   {
+      std::vector<ParIndexSource *> sources;
+      for (size_t c = 0; c < fChunks.size(); ++c) {
+         auto spill = SpillName(output, c);
+         FILE *in = fopen(spill.Data(), "rb");
+         if (!in) {
+            Error("ParIndexBuilder", "Cannot read back %s", spill.Data());
+            for (auto source : sources)
+               delete source;
+            return false;
+         }
+         sources.push_back(new ParIndexSource(in));
+      }
+      FILE *out = fopen(output, "wb");
+      if (!out) {
+         Error("ParIndexBuilder", "Cannot write %s", output);
+         for (auto source : sources)
+            delete source;
+         return false;
+      }
+
+      ParIndexHeader header;
+      memcpy(header.fMagic, kParIndexMagic, sizeof(header.fMagic));
+      header.fNRecords = 0;
+      header.fNEntries = fNEntries;
+      header.fReserved = 0;
+      bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+      std::vector<ParIndexRecord> buffer;
+      buffer.reserve(kBufferRecords);
+      auto flush = [&]() {
+         ok = ok && fwrite(buffer.data(), sizeof(ParIndexRecord), buffer.size(), out) == buffer.size();
+         header.fNRecords += buffer.size();
+         buffer.clear();
+      };
+      Merge(sources, [&](const ParIndexRecord &rec) {
+         buffer.push_back(rec);
+         if (buffer.size() == kBufferRecords)
+            flush();
+      });
+      flush();
+      // The header again, now with the number of records.
+      rewind(out);
+      ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+      ok = (fclose(out) == 0) && ok;
+      if (!ok) {
+         Error("ParIndexBuilder", "Cannot write %s", output);
+         gSystem->Unlink(output);
+      }
+      return ok;
+   }
+
+   // k-way merge of the sorted sources; takes ownership of them. If fUnique,
+   // duplicate keys are passed to emit once, with their lowest entry.
+   template <class EMIT>
+   void Merge(std::vector<ParIndexSource *> &sources, EMIT emit)
+   {
+      auto later = [](ParIndexSource *a, ParIndexSource *b) { return b->Current() < a->Current(); };
+      std::priority_queue<ParIndexSource *, std::vector<ParIndexSource *>, decltype(later)> heap(later);
+      for (auto source : sources) {
+         if (source->Valid())
+            heap.push(source);
+         else
+            delete source;
+      }
+      bool first = true;
+      ParIndexRecord last{0, 0, 0};
+      while (!heap.empty()) {
+         ParIndexSource *source = heap.top();
+         heap.pop();
+         const ParIndexRecord &rec = source->Current();
+         if (!fUnique || first || rec.fMajor != last.fMajor || rec.fMinor != last.fMinor) {
+            emit(rec);
+            last = rec;
+            first = false;
+         }
+         source->Next();
+         if (source->Valid())
+            heap.push(source);
+         else
+            delete source;
+      }
+      sources.clear();
+   }
+
+   TString fTreeName;
+   std::vector<std::string> fFiles;
+   TString fMajor;
+   TString fMinor;
+   Long64_t fChunkEntries;
+   bool fUnique;
+   Long64_t fNEntries;
+   std::vector<ParIndexChunk> fChunks;
+};
+
+// Read-only view of an index file written by ParIndexBuilder, memory mapped
+// where available.
+class ParIndexFile {
+public:
+   ParIndexFile(const char *path) : fMapped(nullptr), fMappedSize(0), fRecords(nullptr), fNRecords(0), fNEntries(0)
+   {
+#ifndef _WIN32
+      int fd = open(path, O_RDONLY);
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ParIndexHeader)) {
+         void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+         if (addr != MAP_FAILED) {
+            fMapped = addr;
+            fMappedSize = st.st_size;
+         }
+      }
+      if (fd >= 0)
+         close(fd);
+      if (fMapped && !SetUp((const char *)fMapped, fMappedSize)) {
+         munmap(fMapped, fMappedSize);
+         fMapped = nullptr;
+      }
+      if (fMapped)
+         return;
+#endif
+      // No mmap: read the whole file.
+      FILE *in = fopen(path, "rb");
+      if (!in) {
+         Error("ParIndexFile", "Cannot open %s", path);
+         return;
+      }
+      fseek(in, 0, SEEK_END);
+      long size = ftell(in);
+      rewind(in);
+      if (size > 0) {
+         fData.resize(size);
+         if (fread(&fData[0], 1, size, in) == (size_t)size)
+            SetUp(fData.data(), size);
+      }
+      fclose(in);
+      if (!fRecords)
+         Error("ParIndexFile", "%s is not a valid index file", path);
+   }
+
+   ~ParIndexFile()
+   {
+#ifndef _WIN32
+      if (fMapped)
+         munmap(fMapped, fMappedSize);
+#endif
+   }
+
+   bool IsValid() const { return fRecords != nullptr; }
+   bool IsMapped() const { return fMapped != nullptr; }
+   Long64_t GetN() const { return fNRecords; }
+   Long64_t GetEntries() const { return fNEntries; }
+   const ParIndexRecord &operator[](Long64_t i) const { return fRecords[i]; }
+
+   // As TTree::GetEntryNumberWithIndex: the entry with exactly this key, or -1.
+   Long64_t GetEntryNumberWithIndex(Long64_t major, Long64_t minor = 0) const
+   {
+      if (!fRecords)
+         return -1;
+      ParIndexRecord key{major, minor, -1};
+      const ParIndexRecord *end = fRecords + fNRecords;
+      const ParIndexRecord *found = std::lower_bound(fRecords, end, key);
+      if (found == end || found->fMajor != major || found->fMinor != minor)
+         return -1;
+      return found->fEntry;
+   }
+
+private:
+   ParIndexFile(const ParIndexFile &) = delete;
+   ParIndexFile &operator=(const ParIndexFile &) = delete;
+
+   bool SetUp(const char *data, size_t size)
+   {
+      if (size < sizeof(ParIndexHeader))
+         return false;
+      ParIndexHeader header;
+      memcpy(&header, data, sizeof(header));
+      if (memcmp(header.fMagic, kParIndexMagic, sizeof(header.fMagic)) || header.fNRecords < 0 ||
+          sizeof(header) + header.fNRecords * sizeof(ParIndexRecord) > size)
+         return false;
+      fRecords = (const ParIndexRecord *)(data + sizeof(header));
+      fNRecords = header.fNRecords;
+      fNEntries = header.fNEntries;
+      return true;
+   }
+
+   void *fMapped;
+   size_t fMappedSize;
+   std::vector<char> fData;
+   const ParIndexRecord *fRecords;
+   Long64_t fNRecords;
+   Long64_t fNEntries;
+};
+
+#endif // ROOTTEST_PARALLELINDEX_H
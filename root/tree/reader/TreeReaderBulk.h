@@ -0,0 +1,154 @@
+#ifndef ROOTTEST_TREEREADERBULK_H
+#define ROOTTEST_TREEREADERBULK_H
+
+// Basket-at-a-time access to a branch of fundamental type T, fixed size
+// arrays of T, or std::vector<T>: instead of one proxy access per element as
+// with TTreeReaderValue / TTreeReaderArray, Load(entry) makes the entries of
+// the whole basket holding entry available as one contiguous array.
+//
+//    TreeReaderBulk<float> bulk(tree, "px");
+//    for (Long64_t entry = 0; bulk.Load(entry); entry = bulk.GetEndEntry())
+//       for (Long64_t e = bulk.GetFirstEntry(); e < bulk.GetEndEntry(); ++e)
+//          for (const float *x = bulk.Begin(e); x != bulk.End(e); ++x)
+//             ...
+//
+// Branches that support TBranch's bulk read (a single leaf, no counter) are
+// deserialized with one array copy per basket into a buffer of the reader: a
+// memcpy on big endian hosts, a byte swap on little endian ones. std::vector<T>
+// and other branches are read entry by entry into a contiguous buffer, with
+// an offset per entry; the branch's address is restored afterwards.
+
+#include "TBranch.h"
+#include "TBranchElement.h"
+#include "TBufferFile.h"
+#include "TDataType.h"
+#include "TError.h"
+#include "TLeaf.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <typeinfo>
+#include <vector>
+
+template <typename T>
+class TreeReaderBulk {
+public:
+   enum EMode { kInvalid, kBulk, kVector, kCopy };
+
+   TreeReaderBulk(TTree *tree, const char *branchName)
+      : fBranch(tree->GetBranch(branchName)), fMode(kInvalid), fLen(1), fBuffer(TBuffer::kWrite, 32 * 1024),
+        fData(nullptr), fFirst(-1), fEnd(-1)
+   {
+      if (!fBranch) {
+         Error("TreeReaderBulk", "No branch %s", branchName);
+         return;
+      }
+      const char *typeName = TDataType::GetTypeName(TDataType::GetType(typeid(T)));
+      TLeaf *leaf = fBranch->GetNleaves() == 1 ? (TLeaf *)fBranch->GetListOfLeaves()->UncheckedAt(0) : nullptr;
+      auto element = dynamic_cast<TBranchElement *>(fBranch);
+      if (element && TString(element->GetClassName()) == TString::Format("vector<%s>", typeName)) {
+         fMode = kVector;
+      } else if (leaf && !leaf->GetLeafCount() && TString(leaf->GetTypeName()) == typeName) {
+         fLen = leaf->GetLenStatic();
+         fMode = fBranch->SupportsBulkRead() ? kBulk : kCopy;
+      } else {
+         Error("TreeReaderBulk", "Branch %s is not of type %s, %s[N] or vector<%s>", branchName, typeName, typeName,
+               typeName);
+      }
+   }
+
+   EMode GetMode() const { return fMode; }
+
+   // Make the basket holding entry available; false past the last entry.
+   bool Load(Long64_t entry)
+   {
+      if (fMode == kInvalid || entry < 0 || entry >= fBranch->GetEntries())
+         return false;
+      if (entry >= fFirst && entry < fEnd)
+         return true;
+      const Long64_t *basketEntry = fBranch->GetBasketEntry();
+      const Int_t nbaskets = fBranch->GetWriteBasket();
+      const Int_t basket = std::upper_bound(basketEntry, basketEntry + nbaskets, entry) - basketEntry - 1;
+      fFirst = basket >= 0 ? basketEntry[basket] : 0;
+      fEnd = basket >= 0 && basket + 1 < nbaskets ? basketEntry[basket + 1] : fBranch->GetEntries();
+
+      switch (fMode) {
+      case kBulk: {
+         // Fails for baskets still in memory, which are copied instead.
+         Int_t n = basket >= 0 ? fBranch->GetBulkRead().GetBulkEntries(fFirst, fBuffer) : -1;
+         if (n <= 0)
+            return LoadCopy();
+         fEnd = fFirst + n;
+         fData = reinterpret_cast<const T *>(fBuffer.GetCurrent());
+         return true;
+      }
+      case kVector: {
+         std::vector<T> values, *address = &values;
+         ReadEntries(&address, [&]() { fCopy.insert(fCopy.end(), values.begin(), values.end()); });
+         return true;
+      }
+      case kCopy:
+         return LoadCopy();
+      default:
+         return false;
+      }
+   }
+
+   // The entries loaded: [GetFirstEntry(), GetEndEntry()).
+   Long64_t GetFirstEntry() const { return fFirst; }
+   Long64_t GetEndEntry() const { return fEnd; }
+
+   // The elements of a loaded entry.
+   const T *Begin(Long64_t entry) const
+   {
+      return fMode == kVector ? fData + fOffsets[entry - fFirst] : fData + (entry - fFirst) * fLen;
+   }
+   const T *End(Long64_t entry) const
+   {
+      return fMode == kVector ? fData + fOffsets[entry - fFirst + 1] : fData + (entry - fFirst + 1) * fLen;
+   }
+   size_t GetSize(Long64_t entry) const { return End(entry) - Begin(entry); }
+   // All elements of the loaded entries.
+   const T *GetData() const { return fData; }
+
+private:
+   bool LoadCopy()
+   {
+      std::vector<T> values(fLen);
+      ReadEntries(values.data(), [&]() { fCopy.insert(fCopy.end(), values.begin(), values.end()); });
+      return true;
+   }
+
+   // Read the loaded entries into address, appending each with append(), then
+   // give the branch back the address it had, if any.
+   template <class APPEND>
+   void ReadEntries(void *address, APPEND append)
+   {
+      char *previous = fBranch->GetAddress();
+      fBranch->SetAddress(address);
+      fCopy.clear();
+      fOffsets.assign(1, 0);
+      for (Long64_t entry = fFirst; entry < fEnd; ++entry) {
+         fBranch->GetEntry(entry);
+         append();
+         fOffsets.push_back(fCopy.size());
+      }
+      if (previous)
+         fBranch->SetAddress(previous);
+      else
+         fBranch->ResetAddress();
+      fData = fCopy.data();
+   }
+
+   TBranch *fBranch;
+   EMode fMode;
+   Int_t fLen;                 // elements per entry, if not kVector
+   TBufferFile fBuffer;        // kBulk: the deserialized basket
+   std::vector<T> fCopy;       // kVector, kCopy: the elements
+   std::vector<size_t> fOffsets; // kVector: index of each entry's first element
+   const T *fData;
+   Long64_t fFirst;
+   Long64_t fEnd;
+};
+
+#endif // ROOTTEST_TREEREADERBULK_H
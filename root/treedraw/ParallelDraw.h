@@ -0,0 +1,189 @@
+#ifndef ROOTTEST_PARALLELDRAW_H
+#define ROOTTEST_PARALLELDRAW_H
+
+// TTree::Draw of an expression into a histogram, with the chain split into
+// chunks of whole clusters that are filled in parallel (with IMT in a thread
+// pool).
+//
+// Every chunk has its own file handle, TTreeFormula pair and histogram, a
+// clone of the model. The chunk histograms are then added in chunk order,
+// never in task completion order: the result depends on the chunk size, but
+// not on the number of threads nor on the scheduling.
+//
+//    ParallelDraw draw("T", files);
+//    TH1D model("h", "px", 100, -5, 5);
+//    std::unique_ptr<TH1> h(draw.Draw("px", "pz>0", model, 8));   // 8 threads
+//
+// As for TTree::Draw, the selection is a weight, array expressions fill one
+// value per instance, and the histogram is filled with the model's binning
+// (no automatic binning). The expression is one dimensional.
+
+#include "RConfigure.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TH1.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
+#include "TTreeFormulaManager.h"
+
+#ifdef R__USE_IMT
+#include "ROOT/TThreadExecutor.hxx"
+#endif
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ParallelDraw {
+public:
+   ParallelDraw(const char *treeName, const std::vector<std::string> &files)
+      : fTreeName(treeName), fFiles(files), fChunkEntries(100000), fSelected(0)
+   {
+   }
+
+   // Upper bound of the entries per chunk, unless a single cluster is larger.
+   void SetChunkEntries(Long64_t n) { fChunkEntries = n > 0 ? n : 1; }
+
+   size_t GetNChunks() const { return fChunks.size(); }
+   // Number of values filled by the last Draw, as returned by TTree::Draw.
+   Long64_t GetSelectedRows() const { return fSelected; }
+
+   // Fill a clone of model with varexp for the entries passing selection.
+   // Returns nullptr on error. nthreads = 0 uses the default pool size.
+   TH1 *Draw(const char *varexp, const char *selection, const TH1 &model, unsigned int nthreads = 0)
+   {
+      fSelected = 0;
+      if (!MakeChunks())
+         return nullptr;
+
+      // Clone before going parallel: cloning registers with gROOT.
+      std::vector<std::unique_ptr<TH1>> hists(fChunks.size());
+      for (auto &h : hists) {
+         h.reset(static_cast<TH1 *>(model.Clone()));
+         h->SetDirectory(nullptr);
+         h->Reset();
+      }
+      std::vector<Long64_t> selected(fChunks.size(), -1);
+      auto fillOne = [&](unsigned int c) { selected[c] = FillChunk(fChunks[c], varexp, selection, *hists[c]); };
+
+#ifdef R__USE_IMT
+      std::vector<unsigned int> ids(fChunks.size());
+      for (size_t c = 0; c < ids.size(); ++c)
+         ids[c] = c;
+      ROOT::EnableThreadSafety();
+      ROOT::TThreadExecutor pool(nthreads);
+      pool.Foreach(fillOne, ids);
+#else
+      (void)nthreads;
+      for (size_t c = 0; c < fChunks.size(); ++c)
+         fillOne(c);
+#endif
+
+      TH1 *result = static_cast<TH1 *>(model.Clone());
+      result->SetDirectory(nullptr);
+      result->Reset();
+      for (size_t c = 0; c < fChunks.size(); ++c) {
+         if (selected[c] < 0) {
+            Error("ParallelDraw", "Cannot draw %s for entries %lld to %lld of %s", varexp, fChunks[c].fFirst,
+                  fChunks[c].fLast, fFiles[fChunks[c].fFile].c_str());
+            delete result;
+            fSelected = 0;
+            return nullptr;
+         }
+         result->Add(hists[c].get());
+         fSelected += selected[c];
+      }
+      return result;
+   }
+
+private:
+   // A range of entries of one file of the chain, made of whole clusters.
+   struct Chunk {
+      int fFile;
+      Long64_t fFirst;
+      Long64_t fLast; // exclusive
+   };
+
+   bool MakeChunks()
+   {
+      fChunks.clear();
+      for (size_t f = 0; f < fFiles.size(); ++f) {
+         std::unique_ptr<TFile> file(TFile::Open(fFiles[f].c_str()));
+         TTree *tree = nullptr;
+         if (file && !file->IsZombie())
+            file->GetObject(fTreeName.Data(), tree);
+         if (!tree) {
+            Error("ParallelDraw", "Cannot read tree %s from %s", fTreeName.Data(), fFiles[f].c_str());
+            return false;
+         }
+         const Long64_t nentries = tree->GetEntries();
+         auto clusters = tree->GetClusterIterator(0);
+         Long64_t first = 0;
+         Long64_t start;
+         while ((start = clusters()) < nentries) {
+            Long64_t end = clusters.GetNextEntry();
+            if (end - first > fChunkEntries && start > first) {
+               fChunks.push_back({(int)f, first, start});
+               first = start;
+            }
+         }
+         if (nentries > first)
+            fChunks.push_back({(int)f, first, nentries});
+      }
+      return true;
+   }
+
+   // Fill hist for the entries of chunk as TSelectorDraw does; returns the
+   // selected rows, -1 on error.
+   Long64_t FillChunk(const Chunk &chunk, const char *varexp, const char *selection, TH1 &hist)
+   {
+      std::unique_ptr<TFile> file(TFile::Open(fFiles[chunk.fFile].c_str()));
+      TTree *tree = nullptr;
+      if (file && !file->IsZombie())
+         file->GetObject(fTreeName.Data(), tree);
+      if (!tree)
+         return -1;
+      TTreeFormula var("ParallelDrawVar", varexp, tree);
+      std::unique_ptr<TTreeFormula> select;
+      if (selection && *selection)
+         select.reset(new TTreeFormula("ParallelDrawSelect", selection, tree));
+      if (!var.GetNdim() || (select && !select->GetNdim()))
+         return -1;
+      // The manager is deleted with the last formula it holds.
+      auto manager = new TTreeFormulaManager;
+      manager->Add(&var);
+      if (select)
+         manager->Add(select.get());
+      manager->Sync();
+
+      tree->SetCacheSize();
+      tree->SetCacheEntryRange(chunk.fFirst, chunk.fLast);
+      Long64_t selected = 0;
+      for (Long64_t entry = chunk.fFirst; entry < chunk.fLast; ++entry) {
+         tree->LoadTree(entry);
+         const Int_t ndata = manager->GetNdata();
+         for (Int_t i = 0; i < ndata; ++i) {
+            Double_t weight = select ? select->EvalInstance(i) : 1;
+            // Always evaluate instance 0: it loads the branches.
+            if (!weight && i > 0)
+               continue;
+            Double_t value = var.EvalInstance(i);
+            if (!weight)
+               continue;
+            hist.Fill(value, weight);
+            ++selected;
+         }
+      }
+      return selected;
+   }
+
+   TString fTreeName;
+   std::vector<std::string> fFiles;
+   Long64_t fChunkEntries;
+   std::vector<Chunk> fChunks;
+   Long64_t fSelected;
+};
+
+#endif // ROOTTEST_PARALLELDRAW_H
@@ -0,0 +1,99 @@
+#include "ParallelDraw.h"
+
+#include "TChain.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TRandom3.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+#include <cmath>
+#include <iostream>
+
+void FillTree(const char *filename, const char *treeName, int seed)
+{
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   TRandom3 rnd(seed);
+   int i;
+   float px, py;
+   int n;
+   float arr[10];
+   t.Branch("i", &i);
+   t.Branch("px", &px);
+   t.Branch("py", &py);
+   t.Branch("n", &n);
+   t.Branch("arr", arr, "arr[n]/F");
+   // Many clusters per file.
+   t.SetAutoFlush(7919);
+   for (i = 0; i < 200000; ++i) {
+      px = rnd.Gaus();
+      py = rnd.Gaus();
+      n = i % 10;
+      for (int j = 0; j < n; ++j)
+         arr[j] = rnd.Rndm();
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+bool Identical(const TH1 &a, const TH1 &b, bool exactStats)
+{
+   if (a.GetEntries() != b.GetEntries())
+      return false;
+   for (int bin = 0; bin <= a.GetNbinsX() + 1; ++bin)
+      if (a.GetBinContent(bin) != b.GetBinContent(bin))
+         return false;
+   // TTree::Draw sums the statistics entry by entry, the parallel Draw chunk
+   // by chunk: they only agree up to rounding.
+   const double tolerance = exactStats ? 0 : 1e-12;
+   return std::abs(a.GetMean() - b.GetMean()) <= tolerance * std::abs(a.GetMean()) &&
+          std::abs(a.GetStdDev() - b.GetStdDev()) <= tolerance * a.GetStdDev();
+}
+
+int main()
+{
+   // reference output must be the same for parallel and sequential execution
+   // Prepare an input chain to run on
+   std::vector<std::string> files{"test_parDraw1.root", "test_parDraw2.root"};
+   auto treeName = "myTree";
+   FillTree(files[0].c_str(), treeName, 1);
+   FillTree(files[1].c_str(), treeName, 2);
+   TChain chain(treeName);
+   for (auto &file : files)
+      chain.Add(file.c_str());
+
+   const char *draws[][2] = {{"px", ""},
+                             {"px*px+py", "i%3==0"},
+                             {"arr", "arr>0.5"},
+                             {"arr[2]-py", "(i%5)*0.5"},
+                             {"sqrt(px*px+py*py)", "Sum$(arr)>2"}};
+   int ret = 0;
+   for (auto draw : draws) {
+      TH1D model("model", draw[0], 100, -3, 3);
+      TH1D sequential("sequential", draw[0], 100, -3, 3);
+      Long64_t rows = chain.Draw(TString::Format("%s>>sequential", draw[0]), draw[1], "goff");
+
+      // The parallel result must not depend on the number of threads.
+      ParallelDraw parallel(treeName, files);
+      parallel.SetChunkEntries(20000);
+      std::unique_ptr<TH1> one(parallel.Draw(draw[0], draw[1], model, 1));
+      std::unique_ptr<TH1> four(parallel.Draw(draw[0], draw[1], model, 4));
+      if (!one || !four) {
+         ++ret;
+         continue;
+      }
+      bool same = Identical(sequential, *four, false) && parallel.GetSelectedRows() == rows;
+      bool deterministic = Identical(*one, *four, true);
+      std::cout << draw[0] << " [" << draw[1] << "]: "
+                << (same ? "same as" : "DIFFERENT from") << " TTree::Draw, "
+                << (deterministic ? "independent of" : "DEPENDS on") << " the number of threads" << std::endl;
+      if (!same || !deterministic)
+         ++ret;
+   }
+
+   for (auto &file : files)
+      gSystem->Unlink(file.c_str());
+   return ret;
+}
@@ -0,0 +1,345 @@
+#ifndef ROOTTEST_BLOCKFORMULA_H
+#define ROOTTEST_BLOCKFORMULA_H
+
+// Evaluation of a formula over a block of n points at once, as for the
+// entries of a basket whose columns are already unpacked: each operation of
+// the formula is one loop over the block, which the compiler vectorizes,
+// instead of one interpretation of the whole formula per point.
+//
+//    BlockFormula f("x<y&&abs(z-0.5)<[0]");
+//    const Double_t *vars[] = {x, y, z, t};  // columns of n values
+//    const Double_t *pars[] = {p0};
+//    f.Eval(n, vars, pars, result);
+//
+// Supported are the variables x, y, z, t, the parameters [i], numbers, pi,
+// the operators + - * / % ** ^ < > <= >= == != && || ! and unary -, and
+// sin, cos, tan, exp, log, sqrt, abs, atan2, pow, with or without TMath::.
+// Logical operators evaluate both sides. Any other formula is evaluated
+// point by point with TFormula::EvalPar; IsVectorized() tells which.
+
+#include "TError.h"
+#include "TFormula.h"
+#include "TMath.h"
+#include "TString.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+class BlockFormula {
+public:
+   BlockFormula(const char *expr) : fExpr(expr), fPos(0), fNpar(0), fDepth(0), fMaxDepth(0)
+   {
+      fValid = ParseOr() && Peek() == 0;
+      if (!fValid) {
+         fProgram.clear();
+         fScalar.reset(new TFormula("BlockFormulaScalar", expr));
+         fNpar = fScalar->GetNpar();
+      }
+   }
+
+   bool IsVectorized() const { return fValid; }
+   Int_t GetNpar() const { return fNpar; }
+
+   // result[i] = formula(vars[0][i], .., vars[3][i]; pars[0][i], ..) for
+   // i < n. vars must have 4 columns, pars GetNpar() columns.
+   void Eval(Int_t n, const Double_t *const *vars, const Double_t *const *pars, Double_t *result)
+   {
+      if (n <= 0)
+         return;
+      if (!fValid) {
+         EvalScalar(n, vars, pars, result);
+         return;
+      }
+      if ((Int_t)fStack.size() < fMaxDepth * n)
+         fStack.resize(fMaxDepth * n);
+      Int_t top = 0; // number of blocks on the stack
+      for (const Op &op : fProgram) {
+         if (op.fCode <= kPar) {
+            // Push a block.
+            Double_t *r = &fStack[top++ * n];
+            if (op.fCode == kConst) {
+               const Double_t v = op.fValue;
+               for (Int_t i = 0; i < n; ++i) r[i] = v;
+            } else {
+               const Double_t *c = op.fCode == kVar ? vars[op.fIndex] : pars[op.fIndex];
+               for (Int_t i = 0; i < n; ++i) r[i] = c[i];
+            }
+            continue;
+         }
+         // Operators have their operands on the stack: top >= 1 for unary
+         // ones, top >= 2 for binary ones.
+         Double_t *b = &fStack[(top - 1) * n]; // top block
+         if (op.fCode < kAdd) {
+            switch (op.fCode) {
+            case kNeg: for (Int_t i = 0; i < n; ++i) b[i] = -b[i]; break;
+            case kNot: for (Int_t i = 0; i < n; ++i) b[i] = !b[i]; break;
+            case kSin: for (Int_t i = 0; i < n; ++i) b[i] = std::sin(b[i]); break;
+            case kCos: for (Int_t i = 0; i < n; ++i) b[i] = std::cos(b[i]); break;
+            case kTan: for (Int_t i = 0; i < n; ++i) b[i] = std::tan(b[i]); break;
+            case kExp: for (Int_t i = 0; i < n; ++i) b[i] = std::exp(b[i]); break;
+            case kLog: for (Int_t i = 0; i < n; ++i) b[i] = std::log(b[i]); break;
+            case kSqrt: for (Int_t i = 0; i < n; ++i) b[i] = std::sqrt(b[i]); break;
+            case kAbs: for (Int_t i = 0; i < n; ++i) b[i] = std::abs(b[i]); break;
+            default: break;
+            }
+            continue;
+         }
+         // Binary: a = a op b.
+         Double_t *a = &fStack[(top - 2) * n];
+         switch (op.fCode) {
+         case kAdd: for (Int_t i = 0; i < n; ++i) a[i] += b[i]; break;
+         case kSub: for (Int_t i = 0; i < n; ++i) a[i] -= b[i]; break;
+         case kMul: for (Int_t i = 0; i < n; ++i) a[i] *= b[i]; break;
+         case kDiv: for (Int_t i = 0; i < n; ++i) a[i] /= b[i]; break;
+         case kMod: for (Int_t i = 0; i < n; ++i) a[i] = std::fmod(a[i], b[i]); break;
+         case kPow: for (Int_t i = 0; i < n; ++i) a[i] = std::pow(a[i], b[i]); break;
+         case kAtan2: for (Int_t i = 0; i < n; ++i) a[i] = std::atan2(a[i], b[i]); break;
+         case kLt: for (Int_t i = 0; i < n; ++i) a[i] = a[i] < b[i]; break;
+         case kGt: for (Int_t i = 0; i < n; ++i) a[i] = a[i] > b[i]; break;
+         case kLe: for (Int_t i = 0; i < n; ++i) a[i] = a[i] <= b[i]; break;
+         case kGe: for (Int_t i = 0; i < n; ++i) a[i] = a[i] >= b[i]; break;
+         case kEq: for (Int_t i = 0; i < n; ++i) a[i] = a[i] == b[i]; break;
+         case kNe: for (Int_t i = 0; i < n; ++i) a[i] = a[i] != b[i]; break;
+         case kAnd: for (Int_t i = 0; i < n; ++i) a[i] = a[i] && b[i]; break;
+         case kOr: for (Int_t i = 0; i < n; ++i) a[i] = a[i] || b[i]; break;
+         default: break;
+         }
+         --top;
+      }
+      for (Int_t i = 0; i < n; ++i)
+         result[i] = fStack[i];
+   }
+
+private:
+   enum ECode {
+      kConst, kVar, kPar,
+      kNeg, kNot, kSin, kCos, kTan, kExp, kLog, kSqrt, kAbs,
+      kAdd, kSub, kMul, kDiv, kMod, kPow, kAtan2,
+      kLt, kGt, kLe, kGe, kEq, kNe, kAnd, kOr
+   };
+
+   struct Op {
+      ECode fCode;
+      Int_t fIndex;
+      Double_t fValue;
+   };
+
+   void EvalScalar(Int_t n, const Double_t *const *vars, const Double_t *const *pars, Double_t *result)
+   {
+      Double_t x[4];
+      std::vector<Double_t> p(fNpar > 0 ? fNpar : 1);
+      for (Int_t i = 0; i < n; ++i) {
+         for (Int_t v = 0; v < 4; ++v)
+            x[v] = vars[v][i];
+         for (Int_t k = 0; k < fNpar; ++k)
+            p[k] = pars[k][i];
+         result[i] = fScalar->EvalPar(x, p.data());
+      }
+   }
+
+   // Recursive descent, emitting the program in postfix order. fDepth
+   // tracks the blocks on the stack at run time.
+
+   void Emit(ECode code, Int_t index = 0, Double_t value = 0)
+   {
+      fProgram.push_back({code, index, value});
+      if (code <= kPar && ++fDepth > fMaxDepth)
+         fMaxDepth = fDepth;
+      else if (code >= kAdd)
+         --fDepth;
+   }
+
+   char Peek()
+   {
+      while (fPos < fExpr.Length() && isspace(fExpr[fPos]))
+         ++fPos;
+      return fPos < fExpr.Length() ? fExpr[fPos] : 0;
+   }
+
+   bool Accept(const char *token)
+   {
+      Peek();
+      if (!fExpr(fPos, fExpr.Length() - fPos).BeginsWith(token))
+         return false;
+      fPos += strlen(token);
+      return true;
+   }
+
+   bool ParseBinary(bool (BlockFormula::*operand)(), const char *const *tokens, const ECode *codes, int ntokens)
+   {
+      if (!(this->*operand)())
+         return false;
+      for (;;) {
+         int t = 0;
+         while (t < ntokens && !Accept(tokens[t]))
+            ++t;
+         if (t == ntokens)
+            return true;
+         if (!(this->*operand)())
+            return false;
+         Emit(codes[t]);
+      }
+   }
+
+   bool ParseOr()
+   {
+      static const char *tokens[] = {"||"};
+      static const ECode codes[] = {kOr};
+      return ParseBinary(&BlockFormula::ParseAnd, tokens, codes, 1);
+   }
+   bool ParseAnd()
+   {
+      static const char *tokens[] = {"&&"};
+      static const ECode codes[] = {kAnd};
+      return ParseBinary(&BlockFormula::ParseEquality, tokens, codes, 1);
+   }
+   // As in C++, x<y==z<t is (x<y)==(z<t).
+   bool ParseEquality()
+   {
+      static const char *tokens[] = {"==", "!="};
+      static const ECode codes[] = {kEq, kNe};
+      return ParseBinary(&BlockFormula::ParseCompare, tokens, codes, 2);
+   }
+   bool ParseCompare()
+   {
+      // Two character operators first.
+      static const char *tokens[] = {"<=", ">=", "<", ">"};
+      static const ECode codes[] = {kLe, kGe, kLt, kGt};
+      return ParseBinary(&BlockFormula::ParseSum, tokens, codes, 4);
+   }
+   bool ParseSum()
+   {
+      static const char *tokens[] = {"+", "-"};
+      static const ECode codes[] = {kAdd, kSub};
+      return ParseBinary(&BlockFormula::ParseProduct, tokens, codes, 2);
+   }
+   bool ParseProduct()
+   {
+      if (!ParseUnary())
+         return false;
+      for (;;) {
+         ECode code;
+         if (Peek() == '*' && fExpr[fPos + 1] != '*')
+            code = kMul;
+         else if (Peek() == '/')
+            code = kDiv;
+         else if (Peek() == '%')
+            code = kMod;
+         else
+            return true;
+         ++fPos;
+         if (!ParseUnary())
+            return false;
+         Emit(code);
+      }
+   }
+   bool ParseUnary()
+   {
+      if (Accept("-")) {
+         if (!ParseUnary())
+            return false;
+         Emit(kNeg);
+         return true;
+      }
+      if (Peek() == '!' && fExpr[fPos + 1] != '=') {
+         ++fPos;
+         if (!ParseUnary())
+            return false;
+         Emit(kNot);
+         return true;
+      }
+      if (Accept("+"))
+         return ParseUnary();
+      return ParsePower();
+   }
+   bool ParsePower()
+   {
+      if (!ParsePrimary())
+         return false;
+      if (Accept("**") || Accept("^")) {
+         if (!ParseUnary()) // right associative
+            return false;
+         Emit(kPow);
+      }
+      return true;
+   }
+   bool ParsePrimary()
+   {
+      char c = Peek();
+      if (c == '(') {
+         ++fPos;
+         return ParseOr() && Accept(")");
+      }
+      if (c == '[') {
+         char *end = nullptr;
+         long index = strtol(fExpr.Data() + fPos + 1, &end, 10);
+         if (end == fExpr.Data() + fPos + 1 || *end != ']' || index < 0)
+            return false;
+         fPos = end + 1 - fExpr.Data();
+         if (index + 1 > fNpar)
+            fNpar = index + 1;
+         Emit(kPar, index);
+         return true;
+      }
+      if (isdigit(c) || c == '.') {
+         char *end = nullptr;
+         Double_t value = strtod(fExpr.Data() + fPos, &end);
+         fPos = end - fExpr.Data();
+         Emit(kConst, 0, value);
+         return true;
+      }
+      if (!isalpha(c))
+         return false;
+      Ssiz_t start = fPos;
+      while (fPos < fExpr.Length() && (isalnum(fExpr[fPos]) || fExpr[fPos] == '_' || fExpr[fPos] == ':'))
+         ++fPos;
+      TString name = fExpr(start, fPos - start);
+      if (name.BeginsWith("TMath::")) {
+         name.Remove(0, 7);
+         name.ToLower();
+      }
+      const char *vars = "xyzt";
+      if (name.Length() == 1 && strchr(vars, name[0])) {
+         Emit(kVar, strchr(vars, name[0]) - vars);
+         return true;
+      }
+      if (name == "pi") {
+         if (Accept("(") && !Accept(")"))
+            return false;
+         Emit(kConst, 0, TMath::Pi());
+         return true;
+      }
+      static const char *unary[] = {"sin", "cos", "tan", "exp", "log", "sqrt", "abs"};
+      static const ECode unaryCodes[] = {kSin, kCos, kTan, kExp, kLog, kSqrt, kAbs};
+      for (int f = 0; f < 7; ++f) {
+         if (name == unary[f]) {
+            if (!Accept("(") || !ParseOr() || !Accept(")"))
+               return false;
+            Emit(unaryCodes[f]);
+            return true;
+         }
+      }
+      if (name == "atan2" || name == "pow") {
+         if (!Accept("(") || !ParseOr() || !Accept(",") || !ParseOr() || !Accept(")"))
+            return false;
+         Emit(name == "pow" ? kPow : kAtan2);
+         return true;
+      }
+      return false;
+   }
+
+   TString fExpr;
+   Ssiz_t fPos;
+   Int_t fNpar;
+   Int_t fDepth;
+   Int_t fMaxDepth;
+   bool fValid;
+   std::vector<Op> fProgram;
+   std::vector<Double_t> fStack;
+   std::unique_ptr<TFormula> fScalar;
+};
+
+#endif // ROOTTEST_BLOCKFORMULA_H
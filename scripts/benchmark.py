@@ -0,0 +1,134 @@
+usage = '''Usage: benchmark.py [--name name] [--warmup n] [--repetitions n] [--threads n]
+                    [--collector pt_collector --roottest-home dir] -- command args...
+
+Runs command n warm-up times, then n timed repetitions, and reports the median,
+minimum and spread of the wall and CPU times. The results are also written to
+<name>.benchmark.json in the working directory. With --threads, the command is
+pinned to that many CPUs and ROOT_MAX_THREADS / ROOTTEST_BENCHMARK_THREADS are
+set accordingly. With --collector, the command is run once more under
+pt_collector, which adds the measurement to the perftrack store; that run is not
+part of the timings, as the preloaded allocator slows it down.'''
+
+import json
+import math
+import optparse
+import os
+import platform
+import resource
+import subprocess
+import sys
+import time
+
+def median(values):
+   values = sorted(values)
+   mid = len(values) // 2
+   if len(values) % 2:
+      return values[mid]
+   return (values[mid - 1] + values[mid]) / 2.
+
+def stddev(values):
+   mean = sum(values) / len(values)
+   return math.sqrt(sum((v - mean) ** 2 for v in values) / len(values))
+
+def pinnedCPUs(threads):
+   # The first `threads` CPUs this process may run on, None to not pin.
+   if threads <= 0 or not hasattr(os, 'sched_getaffinity'):
+      return None
+   cpus = sorted(os.sched_getaffinity(0))
+   if threads > len(cpus):
+      print('benchmark.py: only %d CPUs available for %d threads, not pinning' % (len(cpus), threads))
+      return None
+   return cpus[:threads]
+
+def runOnce(command, env, cpus):
+   # Run command, return its exit code, output, wall and CPU time (s).
+   def pin():
+      if cpus:
+         os.sched_setaffinity(0, cpus)
+   before = resource.getrusage(resource.RUSAGE_CHILDREN)
+   start = time.time()
+   proc = subprocess.Popen(command, env=env, preexec_fn=pin,
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+   output = proc.communicate()[0]
+   wall = time.time() - start
+   after = resource.getrusage(resource.RUSAGE_CHILDREN)
+   cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime - before.ru_stime)
+   return proc.returncode, output, wall, cpu
+
+def printOutput(output):
+   sys.stdout.flush()
+   getattr(sys.stdout, 'buffer', sys.stdout).write(output)
+   sys.stdout.flush()
+
+def main():
+   parser = optparse.OptionParser(usage=usage)
+   parser.add_option('--name', default='benchmark')
+   parser.add_option('--warmup', type='int', default=1)
+   parser.add_option('--repetitions', type='int', default=5)
+   parser.add_option('--threads', type='int', default=0)
+   parser.add_option('--collector', default='')
+   parser.add_option('--roottest-home', dest='roottestHome', default='')
+   options, command = parser.parse_args()
+   if not command or options.repetitions < 1:
+      parser.error('need a command and at least one repetition')
+
+   env = dict(os.environ)
+   cpus = pinnedCPUs(options.threads)
+   if options.threads > 0:
+      env['ROOT_MAX_THREADS'] = str(options.threads)
+      env['ROOTTEST_BENCHMARK_THREADS'] = str(options.threads)
+      env['OMP_NUM_THREADS'] = str(options.threads)
+
+   for i in range(options.warmup):
+      rc, output, wall, cpu = runOnce(command, env, cpus)
+      if rc != 0:
+         printOutput(output)
+         print('benchmark.py: warm-up run %d failed with exit code %d' % (i, rc))
+         return rc
+
+   walls = []
+   cpus_used = []
+   for i in range(options.repetitions):
+      rc, output, wall, cpu = runOnce(command, env, cpus)
+      if rc != 0:
+         printOutput(output)
+         print('benchmark.py: repetition %d failed with exit code %d' % (i, rc))
+         return rc
+      walls.append(wall)
+      cpus_used.append(cpu)
+   # The output of the last repetition, for reference files and logs.
+   printOutput(output)
+
+   results = {
+      'name': options.name,
+      'command': command,
+      'host': platform.node(),
+      'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+      'threads': options.threads,
+      'pinned': cpus or [],
+      'warmup': options.warmup,
+      'repetitions': options.repetitions,
+      'wall': walls,
+      'cpu': cpus_used,
+      'wall_median': median(walls),
+      'wall_min': min(walls),
+      'wall_stddev': stddev(walls),
+      'cpu_median': median(cpus_used),
+   }
+   with open(options.name + '.benchmark.json', 'w') as out:
+      json.dump(results, out, indent=1, sort_keys=True)
+   print('BENCHMARK %s: wall median %.3fs min %.3fs stddev %.3fs, cpu median %.3fs (%d runs, %d threads)'
+         % (options.name, results['wall_median'], results['wall_min'], results['wall_stddev'],
+            results['cpu_median'], options.repetitions, options.threads))
+
+   if options.collector:
+      env['PT_TESTNAME'] = options.name
+      rc, output, wall, cpu = runOnce([options.collector, options.roottestHome] + command, env, cpus)
+      printOutput(output)
+      if rc != 0:
+         print('benchmark.py: perftrack run failed with exit code %d' % rc)
+         return rc
+   return 0
+
+if __name__ == '__main__':
+   sys.exit(main())
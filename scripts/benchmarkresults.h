@@ -0,0 +1,153 @@
+#ifndef ROOTTEST_BENCHMARKRESULTS_H
+#define ROOTTEST_BENCHMARKRESULTS_H
+
+// Results of the benchmark macros: the median of repeated timings, and the
+// JSON file the results are written to.
+//
+//    #include "../../../scripts/benchmarkresults.h"  // relative to the macro
+//
+//    double t = BenchmarkMedian(nrep, [&] { return RunOnce(); });
+//
+//    BenchmarkJSON json("bench.json");
+//    if (!json.IsOpen())
+//       return 1;
+//    json.BeginObject().Add("entries", nentries).BeginArray("results");
+//    json.BeginObject().Add("mode", "bulk").Add("time_s", t).EndObject();
+//    json.EndArray().EndObject();
+//
+// The separators and the closing of whatever is still open are taken care
+// of; strings are escaped and non-finite numbers are written as null.
+
+#include "TError.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+inline double BenchmarkMedian(std::vector<double> v)
+{
+   if (v.empty())
+      return 0.;
+   std::sort(v.begin(), v.end());
+   size_t mid = v.size() / 2;
+   return v.size() % 2 ? v[mid] : (v[mid - 1] + v[mid]) / 2.;
+}
+
+// Median of the values returned by nrep (at least one) calls of func.
+template <class F>
+double BenchmarkMedian(int nrep, F func)
+{
+   std::vector<double> values;
+   for (int rep = 0; rep < std::max(1, nrep); ++rep)
+      values.push_back(func());
+   return BenchmarkMedian(values);
+}
+
+class BenchmarkJSON {
+public:
+   BenchmarkJSON(const char *filename) : fFile(fopen(filename, "w"))
+   {
+      if (!fFile)
+         Error("BenchmarkJSON", "Cannot write %s", filename);
+   }
+
+   ~BenchmarkJSON()
+   {
+      if (!fFile)
+         return;
+      while (!fLevels.empty())
+         End(fLevels.back().fArray ? ']' : '}');
+      fprintf(fFile, "\n");
+      fclose(fFile);
+   }
+
+   bool IsOpen() const { return fFile; }
+
+   // In an object, the key of the member to begin or add; ignored in arrays.
+   BenchmarkJSON &BeginObject(const char *key = nullptr) { return Begin(key, false); }
+   BenchmarkJSON &BeginArray(const char *key = nullptr) { return Begin(key, true); }
+   BenchmarkJSON &EndObject() { return End('}'); }
+   BenchmarkJSON &EndArray() { return End(']'); }
+
+   BenchmarkJSON &Add(const char *key, const char *value)
+   {
+      std::string quoted = "\"";
+      for (const char *c = value; *c; ++c) {
+         if (*c == '"' || *c == '\\')
+            quoted += '\\';
+         quoted += (unsigned char)*c < ' ' ? ' ' : *c;
+      }
+      return Value(key, quoted + "\"");
+   }
+   BenchmarkJSON &Add(const char *key, bool value) { return Value(key, value ? "true" : "false"); }
+   BenchmarkJSON &Add(const char *key, double value)
+   {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.6g", value);
+      return Value(key, std::isfinite(value) ? buf : "null");
+   }
+   template <typename T>
+   typename std::enable_if<std::is_integral<T>::value, BenchmarkJSON &>::type Add(const char *key, T value)
+   {
+      return Value(key, std::to_string(value));
+   }
+
+private:
+   struct Level {
+      bool fArray;
+      bool fEmpty;
+   };
+
+   // Arrays have one element per line, objects all members on one line.
+   void Separate(const char *key)
+   {
+      if (fLevels.empty())
+         return;
+      Level &level = fLevels.back();
+      if (!level.fEmpty)
+         fprintf(fFile, level.fArray ? "," : ", ");
+      if (level.fArray)
+         fprintf(fFile, "\n%*s", int(fLevels.size()), "");
+      else if (key)
+         fprintf(fFile, "\"%s\": ", key);
+      level.fEmpty = false;
+   }
+
+   BenchmarkJSON &Value(const char *key, const std::string &value)
+   {
+      if (fFile) {
+         Separate(key);
+         fprintf(fFile, "%s", value.c_str());
+      }
+      return *this;
+   }
+
+   BenchmarkJSON &Begin(const char *key, bool array)
+   {
+      if (fFile) {
+         Separate(key);
+         fprintf(fFile, array ? "[" : "{");
+         fLevels.push_back({array, true});
+      }
+      return *this;
+   }
+
+   BenchmarkJSON &End(char close)
+   {
+      if (!fFile || fLevels.empty())
+         return *this;
+      if (fLevels.back().fArray && !fLevels.back().fEmpty)
+         fprintf(fFile, "\n%*s", int(fLevels.size()) - 1, "");
+      fprintf(fFile, "%c", close);
+      fLevels.pop_back();
+      return *this;
+   }
+
+   FILE *fFile;
+   std::vector<Level> fLevels; // the arrays and objects still open
+};
+
+#endif // ROOTTEST_BENCHMARKRESULTS_H
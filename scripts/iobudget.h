@@ -0,0 +1,189 @@
+#ifndef ROOTTEST_IOBUDGET_H
+#define ROOTTEST_IOBUDGET_H
+
+// I/O budget of a scope: records the bytes read, the read calls, the baskets
+// unzipped and the branches in the TTreeCache between construction and
+// Stop(), and checks them against expected values with a tolerance. This
+// catches readers that pull in columns or baskets they never use.
+//
+//    #include "../../../scripts/iobudget.h"  // relative to the test macro
+//
+//    IOBudget budget("readOneBranch", file); // or without file: all files
+//    budget.Track(tree);                      // baskets unzipped, cached branches
+//    ... read ...
+//    budget.Stop();
+//    bool ok = budget.ExpectBytesRead(10429, 0.02)
+//              && budget.ExpectCachedBranches(1);
+//
+// The Expect functions print the mismatch to stderr and return false;
+// budget.Print() shows everything recorded.
+
+#include "TError.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TString.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+#include "TTreePerfStats.h"
+#include "TVirtualPerfStats.h"
+
+#include <iostream>
+
+// Counts the baskets of one tree that are unzipped, forwarding to the
+// regular TTreePerfStats bookkeeping.
+class IOBudgetPerfStats : public TTreePerfStats {
+public:
+   IOBudgetPerfStats(const char *name, TTree *tree) : TTreePerfStats(name, tree), fTracked(tree), fUnzipped(0) {}
+
+   void UnzipEvent(TObject *tree, Long64_t pos, Double_t start, Int_t complen, Int_t objlen) override
+   {
+      if (tree == fTracked || tree == fTracked->GetTree())
+         ++fUnzipped;
+      TTreePerfStats::UnzipEvent(tree, pos, start, complen, objlen);
+   }
+
+   Long64_t GetUnzipped() const { return fUnzipped; }
+
+private:
+   TTree *fTracked;
+   Long64_t fUnzipped;
+};
+
+class IOBudget {
+public:
+   IOBudget(const char *name, TFile *file = nullptr)
+      : fName(name), fFile(file), fTree(nullptr), fPerfStats(nullptr), fPrevPerfStats(nullptr), fStopped(false),
+        fBytesRead(0), fReadCalls(0), fUnzipped(-1), fCachedBranches(-1)
+   {
+      fStartBytes = file ? file->GetBytesRead() : TFile::GetFileBytesRead();
+      fStartCalls = file ? file->GetReadCalls() : TFile::GetFileReadCalls();
+   }
+
+   ~IOBudget() { Stop(); }
+
+   void Track(TTree *tree)
+   {
+      // Also record the baskets of tree that are unzipped, and the branches
+      // in its TTreeCache.
+      if (fTree || fStopped || !tree)
+         return;
+      fTree = tree;
+      fPrevPerfStats = gPerfStats;
+      fPerfStats = new IOBudgetPerfStats(fName + "_perfstats", tree);
+   }
+
+   void Stop()
+   {
+      if (fStopped)
+         return;
+      fStopped = true;
+      fBytesRead = (fFile ? fFile->GetBytesRead() : TFile::GetFileBytesRead()) - fStartBytes;
+      fReadCalls = (fFile ? fFile->GetReadCalls() : TFile::GetFileReadCalls()) - fStartCalls;
+      if (fTree) {
+         fUnzipped = fPerfStats->GetUnzipped();
+         fTree->SetPerfStats(nullptr);
+         gPerfStats = fPrevPerfStats;
+         delete fPerfStats;
+         fPerfStats = nullptr;
+
+         fCachedBranches = 0;
+         TFile *file = fTree->GetCurrentFile();
+         auto cache = file ? dynamic_cast<TTreeCache *>(fTree->GetReadCache(file)) : nullptr;
+         if (cache && cache->GetCachedBranches())
+            fCachedBranches = cache->GetCachedBranches()->GetEntriesFast();
+      }
+   }
+
+   Long64_t GetBytesRead() const { return fBytesRead; }
+   Long64_t GetReadCalls() const { return fReadCalls; }
+   // -1 if no tree was tracked.
+   Long64_t GetBasketsUnzipped() const { return fUnzipped; }
+   Long64_t GetCachedBranches() const { return fCachedBranches; }
+
+   // Whether the value is within expected * (1 +- tolerance).
+   bool ExpectBytesRead(Long64_t expected, double tolerance = 0.) const
+   {
+      return Expect("bytes read", fBytesRead, expected, tolerance);
+   }
+   bool ExpectReadCalls(Long64_t expected, double tolerance = 0.) const
+   {
+      return Expect("read calls", fReadCalls, expected, tolerance);
+   }
+   bool ExpectBasketsUnzipped(Long64_t expected, double tolerance = 0.) const
+   {
+      return Expect("baskets unzipped", fUnzipped, expected, tolerance);
+   }
+   bool ExpectCachedBranches(Long64_t expected) const
+   {
+      return Expect("cached branches", fCachedBranches, expected, 0.);
+   }
+
+   // Whether the value does not exceed the budget.
+   bool ExpectAtMostBytesRead(Long64_t budget) const { return AtMost("bytes read", fBytesRead, budget); }
+   bool ExpectAtMostReadCalls(Long64_t budget) const { return AtMost("read calls", fReadCalls, budget); }
+   bool ExpectAtMostBasketsUnzipped(Long64_t budget) const
+   {
+      return AtMost("baskets unzipped", fUnzipped, budget);
+   }
+
+   void Print() const
+   {
+      std::cout << "IOBudget " << fName << ": bytes read " << fBytesRead << ", read calls " << fReadCalls;
+      if (fTree)
+         std::cout << ", baskets unzipped " << fUnzipped << ", cached branches " << fCachedBranches;
+      std::cout << std::endl;
+   }
+
+private:
+   bool Measured(const char *what, Long64_t value) const
+   {
+      if (!fStopped) {
+         Error("IOBudget", "%s: Stop() the budget before checking the %s", fName.Data(), what);
+         return false;
+      }
+      if (value < 0) {
+         Error("IOBudget", "%s: %s not measured, Track() the tree", fName.Data(), what);
+         return false;
+      }
+      return true;
+   }
+
+   bool Expect(const char *what, Long64_t value, Long64_t expected, double tolerance) const
+   {
+      if (!Measured(what, value))
+         return false;
+      double margin = tolerance * expected;
+      if (value >= expected - margin && value <= expected + margin)
+         return true;
+      std::cerr << "IOBudget " << fName << ": " << what << " " << value << ", expected " << expected;
+      if (tolerance > 0.)
+         std::cerr << " +- " << 100. * tolerance << "%";
+      std::cerr << std::endl;
+      return false;
+   }
+
+   bool AtMost(const char *what, Long64_t value, Long64_t budget) const
+   {
+      if (!Measured(what, value))
+         return false;
+      if (value <= budget)
+         return true;
+      std::cerr << "IOBudget " << fName << ": " << what << " " << value << ", budget " << budget << std::endl;
+      return false;
+   }
+
+   TString fName;
+   TFile *fFile;
+   TTree *fTree;
+   IOBudgetPerfStats *fPerfStats;
+   TVirtualPerfStats *fPrevPerfStats;
+   bool fStopped;
+   Long64_t fStartBytes;
+   Long64_t fStartCalls;
+   Long64_t fBytesRead;
+   Long64_t fReadCalls;
+   Long64_t fUnzipped;
+   Long64_t fCachedBranches;
+};
+
+#endif // ROOTTEST_IOBUDGET_H
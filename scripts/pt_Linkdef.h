@@ -1,2 +1,7 @@
 #pragma link C++ class PTVal+;
+// Version 1 kept a running mean and variance; use them as robust estimates.
+#pragma read sourceClass="PTVal" targetClass="PTVal" version="[1]" \
+   source="double fMean; double fVar" target="fMedian,fMAD" \
+   code="{ fMedian = onfile.fMean; fMAD = onfile.fVar / 1.4826; }"
+#pragma link C++ class PTAllocSite+;
 #pragma link C++ class PTData+;
@@ -1,11 +1,16 @@
+#include <algorithm>
+#include <cxxabi.h>
 #include <errno.h>
 #include <iostream>
 #include <fcntl.h>
+#include <map>
 #include <math.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
+#include <sys/file.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -13,6 +18,12 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 #include "TAxis.h"
 #include "TCanvas.h"
@@ -23,13 +34,17 @@
 #include "TH1.h"
 #include "TMath.h"
 #include "TMultiGraph.h"
+#include "TObjArray.h"
+#include "TObjString.h"
 #include "TROOT.h"
 #include "TString.h"
 #include "TSystem.h"
 #include "TText.h"
 #include "TTree.h"
+#include "TTreeIndex.h"
 
 #include "pt_data.h"
+#include "pt_fifo.h"
 
 using namespace std;
 
@@ -38,11 +53,18 @@ enum EMeasurement {
    kMemPeak,
    kMemAlloc,
    kCPUTime,
-   kNumMeasurements
+   kFirstPhase, // CPU time, wall time and RSS per EPTPhase, see PTData::PSet()
+   kFirstCounter = kPTFirstCounterVal, // EPTCounters
+   kNumMeasurements = kPTNumVals
 };
 
 struct PTMeasurement {
-   long memory[4]; // alloc, leak, peak, tag
+   long memory[kPTNumHeaderEntries]; // leak, peak, alloc, tag, number of allocs and threads
+   PTThreadRecord threads[kPTMaxThreadSlots]; // per-thread memory statistics
+   PTPhaseRecord phases[kPTNumPhases]; // per-phase timing, if the test marked phases
+   std::vector<PTCallSiteRecord> sites; // sampled allocation call sites
+   int counterMask; // bit i set if counters[i] was measured
+   double counters[kPTNumCounters]; // EPTCounter values
    double utime;
    double stime;
    double wtime;
@@ -84,37 +106,166 @@ public:
    PTGraph* gr[kNumMeasurements];
 };
 
-const double zLimits[] = {
+// Startup and compilation are dominated by I/O and interpreter noise; the
+// workload is what the test is about and gets the tightest limits.
+const double zLimits[kNumMeasurements] = {
    3.5 /*memleak*/,
    4.5 /*mempeak*/,
    5.0 /*memalloc*/,
-   5.0 /*cputime*/
+   5.0 /*cputime*/,
+   6.0 /*startup cpu*/,  8.0 /*startup wall*/,  5.0 /*startup rss*/,
+   6.0 /*compile cpu*/,  8.0 /*compile wall*/,  5.0 /*compile rss*/,
+   5.0 /*setup cpu*/,    6.0 /*setup wall*/,    4.5 /*setup rss*/,
+   4.0 /*workload cpu*/, 5.0 /*workload wall*/, 4.5 /*workload rss*/,
+   5.0 /*teardown cpu*/, 6.0 /*teardown wall*/, 4.5 /*teardown rss*/,
+   3.5 /*instructions*/,
+   5.0 /*cycles*/,
+   5.0 /*cache misses*/,
+   5.0 /*branch misses*/,
+   8.0 /*context switches*/
 };
 
-const double uncertainty[] = {
+const double uncertainty[kNumMeasurements] = {
    0.50 /*memleak*/,
    1.00 /*mempeak*/,
    1.00 /*memalloc*/,
-   0.05 /*cputime*/
+   0.05 /*cputime*/,
+   0.05 /*startup cpu*/,  0.10 /*startup wall*/,  256. /*startup rss*/,
+   0.05 /*compile cpu*/,  0.10 /*compile wall*/,  256. /*compile rss*/,
+   0.02 /*setup cpu*/,    0.05 /*setup wall*/,    256. /*setup rss*/,
+   0.02 /*workload cpu*/, 0.05 /*workload wall*/, 256. /*workload rss*/,
+   0.02 /*teardown cpu*/, 0.05 /*teardown wall*/, 256. /*teardown rss*/,
+   1.00 /*instructions (M)*/,
+   10.0 /*cycles (M)*/,
+   10.0 /*cache misses (k)*/,
+   10.0 /*branch misses (k)*/,
+   50.0 /*context switches*/
+};
+
+// A measurement is compared to the median of its baseline: the last
+// kBaselineWindow measurements since the most recent level shift of the
+// history (a change point). Being medians, these are robust against the
+// occasional noisy measurement, and a speed-up or an accepted slow-down
+// becomes the new baseline after kMinSegment measurements.
+const unsigned int kBaselineWindow = 30;
+const unsigned int kMinSegment = 5; // measurements on each side of a change point
+const double kChangePointLimit = 8.; // level shift, in standard errors, that makes a change point
+
+struct PTHistory {
+   std::vector<double> val; // measurements, oldest first
+   std::vector<unsigned int> rev; // revision of each measurement
 };
 
 const char* measurementNames[kNumMeasurements] = {
    "memory leaks (kB)",
    "peak memory usage (kB)",
    "sum of memory allocations (kB)",
-   "cpu time (s)"
+   "cpu time (s)",
+   "startup cpu time (s)",  "startup wall time (s)",  "startup RSS (kB)",
+   "compile cpu time (s)",  "compile wall time (s)",  "compile RSS (kB)",
+   "setup cpu time (s)",    "setup wall time (s)",    "setup RSS (kB)",
+   "workload cpu time (s)", "workload wall time (s)", "workload RSS (kB)",
+   "teardown cpu time (s)", "teardown wall time (s)", "teardown RSS (kB)",
+   "instructions (M)",
+   "cycles (M)",
+   "cache misses (k)",
+   "branch misses (k)",
+   "context switches"
+};
+
+//______________________________________________________________________________
+bool ReadFully(int fd, void* buf, size_t len) {
+   // Read len bytes from fd; a FIFO can return less than requested per read().
+   char* pos = (char*)buf;
+   while (len) {
+      ssize_t n = read(fd, pos, len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      pos += n;
+      len -= n;
+   }
+   return true;
+}
+
+//______________________________________________________________________________
+class PTCounters {
+   // Performance counters of the child and everything it spawns, counted
+   // from its exec(). Counters the kernel refuses (no PMU in a VM, too
+   // restrictive perf_event_paranoid, not Linux) are simply not measured.
+public:
+   PTCounters() {
+      for (int i = 0; i < kPTNumCounters; ++i) fFD[i] = -1;
+   }
+   ~PTCounters() {
+      for (int i = 0; i < kPTNumCounters; ++i)
+         if (fFD[i] >= 0) close(fFD[i]);
+   }
+
+   void Open(pid_t child) {
+      // Attach to child, which must not have called exec() yet.
+#if defined(__linux__)
+      static const struct { unsigned int type; unsigned long long config; } events[kPTNumCounters] = {
+         { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+         { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+         { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+         { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+         { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+      };
+      for (int i = 0; i < kPTNumCounters; ++i) {
+         struct perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size = sizeof(attr);
+         attr.type = events[i].type;
+         attr.config = events[i].config;
+         attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+         attr.disabled = 1;
+         attr.enable_on_exec = 1;
+         attr.inherit = 1; // threads and child processes
+         attr.exclude_hv = 1;
+         fFD[i] = syscall(__NR_perf_event_open, &attr, child, -1, -1, 0);
+         if (fFD[i] < 0 && (errno == EACCES || errno == EPERM) && events[i].type == PERF_TYPE_HARDWARE) {
+            // Unprivileged users may still count user space. Not so for
+            // context switches: they happen in the kernel, and would always
+            // read 0 with exclude_kernel, so they are not measured then.
+            attr.exclude_kernel = 1;
+            fFD[i] = syscall(__NR_perf_event_open, &attr, child, -1, -1, 0);
+         }
+      }
+#else
+      (void)child;
+#endif
+   }
+
+   void Read(PTMeasurement& results) const {
+      // Read the counters, scaled up for the time the kernel had to
+      // multiplex them with other events.
+      results.counterMask = 0;
+      for (int i = 0; i < kPTNumCounters; ++i) {
+         results.counters[i] = 0.;
+         unsigned long long val[3]; // value, time enabled, time running
+         if (fFD[i] < 0 || !ReadFully(fFD[i], val, sizeof(val)) || !val[2])
+            continue;
+         results.counters[i] = (double)val[0] * val[1] / val[2];
+         results.counterMask |= 1 << i;
+      }
+   }
+
+private:
+   int fFD[kPTNumCounters]; // file descriptors of the counters, -1 if not available
 };
 
 //______________________________________________________________________________
 void InvokeChild(char** argv, const TString& roottestHome){
    // We are the fork's child. Convert ourselves into root.exe (or whatever else was argv[2])
+   // PT_PRELOAD overrides the location of ptpreload.so, e.g. for CMake builds.
 
-   setenv("LD_PRELOAD", roottestHome + "/scripts/ptpreload.so", 1);
+   const char* preload = getenv("PT_PRELOAD");
+   setenv("LD_PRELOAD", preload ? TString(preload) : roottestHome + "/scripts/ptpreload.so", 1);
    execvp(argv[0], argv);
 }
 
 //______________________________________________________________________________
-PTMeasurement ReceiveResults(const TString& fifoName) {
+PTMeasurement ReceiveResults(const TString& fifoName, const PTCounters& counters) {
    // Retrieve the measurements from the FIFO and from the child's usage data.
 
    int fd = open(fifoName, O_RDONLY);
@@ -123,23 +274,41 @@ PTMeasurement ReceiveResults(const TString& fifoName) {
       exit(1);
    }
 
+   // Read the memory statistics before waiting for the child: the call site
+   // records can exceed the FIFO's capacity.
+   PTMeasurement results;
+   bool readOK = ReadFully(fd, results.memory, sizeof(results.memory))
+      && results.memory[kPTTag] == kPTFifoTag
+      && results.memory[kPTNumThreads] >= 0
+      && results.memory[kPTNumThreads] <= kPTMaxThreadSlots
+      && (results.memory[kPTNumPhaseRecords] == 0
+          || results.memory[kPTNumPhaseRecords] == kPTNumPhases)
+      && results.memory[kPTNumCallSites] >= 0
+      && results.memory[kPTNumCallSites] <= kPTMaxCallSites
+      && ReadFully(fd, results.threads, results.memory[kPTNumThreads] * sizeof(PTThreadRecord))
+      && ReadFully(fd, results.phases, results.memory[kPTNumPhaseRecords] * sizeof(PTPhaseRecord));
+   if (readOK) {
+      results.sites.resize(results.memory[kPTNumCallSites]);
+      readOK = results.sites.empty()
+         || ReadFully(fd, &results.sites[0], results.sites.size() * sizeof(PTCallSiteRecord));
+   }
+   close(fd);
+
    // read child performance information
    int status;
    wait(&status);
+   unlink(fifoName);
    if (status != 0){
-      unlink(fifoName);
       exit(status); // test failed
    }
 
-   // get memory
-   PTMeasurement results;
-   read(fd, &results, 4*sizeof(long));
-   unlink(fifoName);
-   if (results.memory[3] != 699692586){
+   if (!readOK) {
       printf("Error pt_collector: could not read memory usage from FIFO %s\n", fifoName.Data());;
       exit(1);
    }
 
+   counters.Read(results);
+
    // get cpu time
    struct rusage usage;
    getrusage(RUSAGE_CHILDREN, &usage);
@@ -149,18 +318,50 @@ PTMeasurement ReceiveResults(const TString& fifoName) {
 }
 
 //______________________________________________________________________________
-TTree* GetTree(TString& fileName, TString& testName, int argc, char** argv, const TString& cwd, const TString& roottestHome) {
+TString DemangleCallSite(const char* site) {
+   // Demangle the ';' separated frames of a call site sent by ptpreload.so.
+
+   TString demangled;
+   TObjArray* frames = TString(site).Tokenize(";");
+   for (int i = 0; i < frames->GetEntriesFast(); ++i) {
+      const TString& frame = ((TObjString*)frames->At(i))->String();
+      if (i) demangled += ";";
+      int status = 0;
+      char* name = abi::__cxa_demangle(frame, 0, 0, &status);
+      if (status == 0 && name) {
+         demangled += name;
+      } else {
+         demangled += frame;
+      }
+      free(name);
+   }
+   delete frames;
+   return demangled;
+}
+
+//______________________________________________________________________________
+TString GetTestName(int argc, char** argv, const TString& cwd, const TString& roottestHome) {
+   // The test name is the directory relative to roottestHome plus the last argument,
+   // unless set through PT_TESTNAME (e.g. by ROOTTEST_ADD_BENCHMARK).
+   const char* envName = getenv("PT_TESTNAME");
+   if (envName && envName[0]) return envName;
+
    TString lastArg(argv[argc-1]);
 
-   // build test name
-   testName = cwd + "/" + lastArg;
+   TString testName = cwd + "/" + lastArg;
    if (testName.BeginsWith(roottestHome)) {
       testName.Remove(0, roottestHome.Length());
       if (testName[0] == '/') testName.Remove(0, 1);
    }
+   return testName;
+}
 
-   // build file name
-   fileName = testName;
+//______________________________________________________________________________
+TString GetTestFileName(const TString& testName, const char* ext) {
+   // File name of the test's graphs, and of the per-test data files used
+   // before all data went into the store: pt_<dir><test><md5>.<ext>
+
+   TString fileName = testName;
    fileName.ReplaceAll("/", "");
    Ssiz_t posDot = fileName.Index('.');
    if (posDot != kNPOS) {
@@ -168,115 +369,349 @@ TTree* GetTree(TString& fileName, TString& testName, int argc, char** argv, cons
    }
    fileName.Prepend("pt_");
    fileName += testName.MD5();
-   fileName += ".root";
+   fileName += ext;
+   return fileName;
+}
+
+//______________________________________________________________________________
+TString GetStoreName(const TString& roottestHome) {
+   // The performance history of all tests, $PT_HISTORY or
+   // $ROOTTEST_HOME/pt_history.root.
+   const char* env = getenv("PT_HISTORY");
+   if (env && env[0]) return env;
+   return roottestHome + "/pt_history.root";
+}
 
-   TFile* file = TFile::Open(fileName, "UPDATE");
+//______________________________________________________________________________
+class PTStoreLock {
+   // Advisory lock on the store, held while the object lives. Shared locks
+   // allow concurrent readers; appending takes an exclusive one, such that
+   // concurrent pt_collectors (e.g. ctest -j) never see a half-written file.
+public:
+   PTStoreLock(const TString& storeName, bool exclusive): fFD(-1) {
+      TString lockName = storeName + ".lock";
+      fFD = open(lockName, O_RDWR | O_CREAT, 0666);
+      if (fFD < 0 || flock(fFD, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+         printf("Error pt_collector: could not lock %s: %s\n", lockName.Data(), strerror(errno));
+         exit(1);
+      }
+   }
+   ~PTStoreLock() {
+      flock(fFD, LOCK_UN);
+      close(fFD);
+   }
+private:
+   int fFD;
+};
+
+//______________________________________________________________________________
+Long64_t GetTestHash(const TString& testName) {
+   // Major key of the store's index. Collisions are harmless: entries are
+   // matched by their test name, too.
+   return testName.Hash();
+}
+
+//______________________________________________________________________________
+void FindEntries(TTree* tree, Long64_t hash, unsigned int firstRev, unsigned int lastRev,
+                 std::vector<Long64_t>& entryNumbers) {
+   // Append the numbers of the store's entries with the test hash and a
+   // revision within [firstRev, lastRev] to entryNumbers, in the order the
+   // entries were appended. They are looked up in the store's (hash, svn)
+   // index; stores written without one get it built in memory.
+
+   TTreeIndex* index = dynamic_cast<TTreeIndex*>(tree->GetTreeIndex());
+   if (!index) {
+      tree->BuildIndex("hash", "svn");
+      index = dynamic_cast<TTreeIndex*>(tree->GetTreeIndex());
+      if (!index) return;
+   }
+   const Long64_t* major = index->GetIndexValues();
+   const Long64_t* minor = index->GetIndexValuesMinor();
+   const Long64_t* entry = index->GetIndex();
+
+   // First position not below (hash, firstRev); the keys are sorted.
+   Long64_t lo = 0;
+   Long64_t hi = index->GetN();
+   while (lo < hi) {
+      Long64_t mid = lo + (hi - lo) / 2;
+      if (major[mid] < hash || (major[mid] == hash && minor[mid] < firstRev))
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   size_t first = entryNumbers.size();
+   for (; lo < index->GetN() && major[lo] == hash && minor[lo] <= lastRev; ++lo)
+      entryNumbers.push_back(entry[lo]);
+   std::sort(entryNumbers.begin() + first, entryNumbers.end());
+}
+
+//______________________________________________________________________________
+void ReadEntries(TTree* tree, const std::vector<Long64_t>* entryNumbers, const TString* testName,
+                 std::vector<PTData>& entries) {
+   // Append the given entries of tree (all if 0) to entries. If testName is
+   // given, only its entries.
+
+   TString name;
+   PTData data;
+   TString* branchName = &name;
+   PTData* branchdata = &data;
+   if (testName) tree->SetBranchAddress("test", &branchName);
+   tree->SetBranchAddress("event", &branchdata);
+
+   Long64_t n = entryNumbers ? (Long64_t)entryNumbers->size() : tree->GetEntries();
+   for (Long64_t i = 0; i < n; ++i) {
+      Long64_t entry = entryNumbers ? (*entryNumbers)[i] : i;
+      if (testName) {
+         tree->GetBranch("test")->GetEntry(entry);
+         if (name != *testName) continue;
+         tree->GetBranch("event")->GetEntry(entry);
+      } else {
+         tree->GetEntry(entry);
+      }
+      entries.push_back(data);
+   }
+   tree->ResetBranchAddresses();
+}
+
+//______________________________________________________________________________
+void WriteToStore(const TString& storeName, const TString& testName,
+                  const std::vector<PTData>& entries) {
+   // Append entries to the store and update its (test hash, revision)
+   // index. The caller holds its exclusive lock.
+
+   TFile* file = TFile::Open(storeName, "UPDATE");
    if (!file || file->IsZombie()) {
-      printf("Error pt_collector: could not open data file %s\n", fileName.Data());
+      printf("Error pt_collector: could not open data file %s\n", storeName.Data());
       exit(1);
    }
 
+   TString name(testName);
+   TString* branchName = &name;
+   Long64_t hash = GetTestHash(testName);
+   unsigned int svn = 0;
+   PTData* branchdata = 0;
+
    TTree* tree = 0;
-   file->GetObject("PerftrackTree", tree);
+   file->GetObject("PerftrackHistory", tree);
    if (!tree) {
-      PTData* data = 0;
-      tree = new TTree("PerftrackTree", "Performance tracking data");
-      tree->Branch("event", &data);
-      tree->GetUserInfo()->Add(new TObjString(testName));
+      tree = new TTree("PerftrackHistory", "Performance tracking data of all tests");
+      // Unsplit: each append writes a basket per branch.
+      tree->Branch("test", &branchName, 32000, 0);
+      tree->Branch("hash", &hash, "hash/L");
+      tree->Branch("svn", &svn, "svn/i");
+      tree->Branch("event", &branchdata, 32000, 0);
    } else {
-      TObject* userInfoTest = tree->GetUserInfo()->FindObject(testName);
-      if (!userInfoTest) {
-         // We have a hash collision: there is another test with a
-         // different name writing into the same ROOT file as the
-         // current test.
-         // We can't do much about it; just ignore this test for
-         // performance tracking.
-         exit(0);
+      tree->SetBranchAddress("test", &branchName);
+      tree->SetBranchAddress("hash", &hash);
+      tree->SetBranchAddress("svn", &svn);
+      tree->SetBranchAddress("event", &branchdata);
+   }
+
+   for (size_t i = 0; i < entries.size(); ++i) {
+      branchdata = const_cast<PTData*>(&entries[i]);
+      svn = entries[i].svn;
+      tree->Fill();
+   }
+   tree->BuildIndex("hash", "svn");
+   tree->Write(0, TObject::kWriteDelete);
+   tree->ResetBranchAddresses();
+   delete file;
+}
+
+//______________________________________________________________________________
+void ReadHistory(const TString& storeName, const TString& testName,
+                 std::vector<PTData>& entries) {
+   // Read the test's measurements, oldest first. If the store has none, the
+   // ones of the test's per-test file of old are imported into the store,
+   // under the same exclusive lock: concurrent runs of a test import them
+   // once.
+
+   PTStoreLock lock(storeName, true);
+   {
+      TFile* file = 0;
+      if (!gSystem->AccessPathName(storeName))
+         file = TFile::Open(storeName, "READ");
+      TTree* tree = 0;
+      if (file) file->GetObject("PerftrackHistory", tree);
+      if (tree) {
+         std::vector<Long64_t> entryNumbers;
+         FindEntries(tree, GetTestHash(testName), 0, (unsigned int)-1, entryNumbers);
+         ReadEntries(tree, &entryNumbers, &testName, entries);
+      }
+      delete file;
+   }
+   if (!entries.empty()) return;
+
+   TString legacyName = GetTestFileName(testName, ".root");
+   if (gSystem->AccessPathName(legacyName)) return;
+   TFile* file = TFile::Open(legacyName, "READ");
+   TTree* tree = 0;
+   if (file) file->GetObject("PerftrackTree", tree);
+   if (tree && tree->GetUserInfo()->FindObject(testName))
+      ReadEntries(tree, 0, 0, entries);
+   delete file;
+   if (!entries.empty()) WriteToStore(storeName, testName, entries);
+}
+
+//______________________________________________________________________________
+void AppendToStore(const TString& storeName, const TString& testName,
+                   const std::vector<PTData>& entries) {
+   // Append entries to the store, under its exclusive lock.
+
+   PTStoreLock lock(storeName, true);
+   WriteToStore(storeName, testName, entries);
+}
+
+//______________________________________________________________________________
+size_t FindChangePoint(const PTHistory& hist, double uncertainty) {
+   // Return the index of the first measurement after the most recent level
+   // shift in the last 2*kBaselineWindow measurements, 0 if there is none.
+   // Candidate splits compare the medians before and after the split, in
+   // units of the standard error of their difference (from the pooled robust
+   // sigma); this favors the split at the actual shift.
+
+   size_t n = hist.val.size();
+   size_t begin = n > 2 * kBaselineWindow ? n - 2 * kBaselineWindow : 0;
+   size_t changePoint = 0;
+   double maxScore = kChangePointLimit;
+   PTVal left;
+   PTVal right;
+   for (size_t split = begin + kMinSegment; split + kMinSegment <= n; ++split) {
+      left.Set(0., std::vector<double>(hist.val.begin() + begin, hist.val.begin() + split), 0);
+      right.Set(0., std::vector<double>(hist.val.begin() + split, hist.val.end()), 0);
+      double nLeft = split - begin;
+      double nRight = n - split;
+      double sigma = (nLeft * left.Sigma() + nRight * right.Sigma()) / (nLeft + nRight) + uncertainty;
+      double score = fabs(right.fMedian - left.fMedian) / (sigma * sqrt(1. / nLeft + 1. / nRight));
+      if (score > maxScore) {
+         maxScore = score;
+         changePoint = split;
       }
    }
-   return tree;
+   return changePoint;
 }
 
 //______________________________________________________________________________
-void FillData(const PTMeasurement& results, TTree* tree, PTData& prevdata, PTData& newdata) {
+void FillData(const PTMeasurement& results, const PTHistory* history,
+              PTData& prevdata, PTData& newdata) {
 
    // Whether the previous is outlier or not, it contains the relevant
-   // average / variance etc data.
+   // entry counts.
 
    time_t rawtime;
    time(&rawtime);
    newdata.date = ctime(&rawtime);
 
-   double resdata[4] = {
+   double resdata[kNumMeasurements] = {
       results.memory[kMemLeak]/1024.,
       results.memory[kMemPeak]/1024.,
       results.memory[kMemAlloc]/1024., // in kilobyte
       results.utime + results.stime // in seconds
    };
+   newdata.phases = 0;
+   for (long p = 0; p < results.memory[kPTNumPhaseRecords]; ++p) {
+      const PTPhaseRecord& phase = results.phases[p];
+      if (!phase.fEntered) continue;
+      newdata.phases |= 1 << p;
+      resdata[kFirstPhase + kPTNumPhaseVals * p] = phase.fCPUTime / 1000000.; // in seconds
+      resdata[kFirstPhase + kPTNumPhaseVals * p + 1] = phase.fWallTime / 1000000.;
+      resdata[kFirstPhase + kPTNumPhaseVals * p + 2] = phase.fRSS / 1024.; // in kilobyte
+   }
+   newdata.counters = results.counterMask;
+   resdata[kFirstCounter + kPTInstructions] = results.counters[kPTInstructions] / 1e6;
+   resdata[kFirstCounter + kPTCycles] = results.counters[kPTCycles] / 1e6;
+   resdata[kFirstCounter + kPTCacheMisses] = results.counters[kPTCacheMisses] / 1e3;
+   resdata[kFirstCounter + kPTBranchMisses] = results.counters[kPTBranchMisses] / 1e3;
+   resdata[kFirstCounter + kPTContextSwitches] = results.counters[kPTContextSwitches];
 
    newdata.statEntries = prevdata.statEntries + 1;
-   newdata.historyThinningCounter = prevdata.historyThinningCounter + 1;
+   for (int p = 0; p < kPTNumPhases; ++p) {
+      newdata.phaseEntries[p] = prevdata.phaseEntries[p] + ((newdata.phases >> p) & 1);
+   }
+   for (int c = 0; c < kPTNumCounters; ++c) {
+      newdata.counterEntries[c] = prevdata.counterEntries[c] + ((newdata.counters >> c) & 1);
+   }
    for (int i = 0; i < kNumMeasurements; ++i) {
-      newdata.pval[i]->Set(resdata[i], *prevdata.pval[i], newdata.statEntries);
+      if (newdata.Has(i)) {
+         const PTHistory& hist = history[i];
+         size_t begin = FindChangePoint(hist, uncertainty[i]);
+         unsigned int changeRev = begin ? hist.rev[begin] : 0;
+         if (hist.val.size() - begin > kBaselineWindow)
+            begin = hist.val.size() - kBaselineWindow;
+         std::vector<double> baseline(hist.val.begin() + begin, hist.val.end());
+         newdata.pval[i]->Set(resdata[i], baseline, changeRev);
+      } else {
+         // Not measured this time; carry the statistics forward.
+         *newdata.pval[i] = *prevdata.pval[i];
+      }
    }
    newdata.svn = gROOT->GetSvnRevision();
    newdata.outlier = 0;
+
+   newdata.numAllocs = results.memory[kPTNumAllocs];
+   for (long i = 0; i < results.memory[kPTNumThreads]; ++i) {
+      newdata.threadMemPeak.push_back(results.threads[i].fMaxHeap / 1024.);
+      newdata.threadNumAllocs.push_back(results.threads[i].fNumAllocs);
+   }
+
+   // Different return addresses within the same functions end up as
+   // separate records; merge them.
+   newdata.allocSampleInterval = results.memory[kPTSampleInterval];
+   std::map<TString, PTAllocSite> sites;
+   for (size_t i = 0; i < results.sites.size(); ++i) {
+      const PTCallSiteRecord& record = results.sites[i];
+      TString name = DemangleCallSite(record.fSite);
+      PTAllocSite& site = sites[name];
+      site.fSite = name;
+      for (int b = 0; b < kPTNumSizeBuckets; ++b)
+         site.fNumAllocs[b] += record.fNumAllocs[b];
+      site.fBytes += record.fBytes;
+   }
+   for (std::map<TString, PTAllocSite>::const_iterator i = sites.begin(); i != sites.end(); ++i)
+      newdata.allocSites.push_back(i->second);
 }
 
 //______________________________________________________________________________
 void FillGraphEntry(int i, PTGraph& graph, const PTVal& val,
-                    unsigned int statEntries, unsigned int rev, int outlier) {
+                    unsigned int rev, int outlier) {
    TGraphErrors* gr = graph.good;
    int *n = &graph.nGood;
-   double var = val.fVar;
-   double mean = val.fMean;
 
    bool ioutlier = outlier & (1 << i);
    if (ioutlier) {
       gr = graph.bad;
       n = &graph.nBad;
-      mean = mean * statEntries + val.fVal;
-      double sumVal2 = val.fSumVal2 + val.fVal * val.fVal;
-      double var2 = sumVal2 - mean * mean;
-      if (var2 > 0.) {
-         var = sqrt(var2) / (statEntries + 1.);
-      } else {
-         var = 0.;
-      }
-      mean /= statEntries + 1.;
    }
 
-   var += uncertainty[i];
+   double sigma = val.Sigma() + uncertainty[i];
 
    gr->SetPoint(*n, (double)rev, val.fVal);
-   gr->SetPointError(*n, 0., var);
+   gr->SetPointError(*n, 0., sigma);
    ++(*n);
-   graph.limit->SetPoint(graph.nLimit, (double)rev,  mean);
+   graph.limit->SetPoint(graph.nLimit, (double)rev, val.fMedian);
    graph.limit->SetPointError(graph.nLimit++, 0.5, 0.5,
-                              0. /*"mean" would zoom y axis out completely*/,
-                              zLimits[i] * var);
+                              0. /*"median" would zoom y axis out completely*/,
+                              zLimits[i] * sigma);
 }
 
 //______________________________________________________________________________
-PTGraphColl* CreateOldGraphs(TTree* tree, PTData &olddata) {
-   // Allocate the graphs, fill old data
-
-   Long64_t entries = tree->GetEntries();
-   PTGraphColl* graphs = new PTGraphColl(entries + 1);
-   if (!entries) return graphs;
+PTGraphColl* CreateOldGraphs(const std::vector<PTData>& entries, PTHistory* history) {
+   // Allocate the graphs, fill old data and the history of each measurement.
 
-   PTData *branchdata = &olddata;
-   tree->SetBranchAddress("event", &branchdata);
+   PTGraphColl* graphs = new PTGraphColl(entries.size() + 1);
 
-   for (Long64_t entry = 0; entry < entries; ++entry) {
-      tree->GetEntry(entry);
+   for (size_t entry = 0; entry < entries.size(); ++entry) {
+      const PTData& data = entries[entry];
       for (int i = 0; i < kNumMeasurements; ++i) {
-         FillGraphEntry(i, *(graphs->gr[i]), *(branchdata->pval[i]),
-                        branchdata->statEntries,
-                        branchdata->svn, branchdata->outlier);
+         if (!data.Has(i)) continue;
+         FillGraphEntry(i, *(graphs->gr[i]), *(data.pval[i]),
+                        data.svn, data.outlier);
+         // Outliers are part of the history too: a lasting slow-down shows
+         // up as a change point.
+         history[i].val.push_back(data.pval[i]->fVal);
+         history[i].rev.push_back(data.svn);
       }
    }
-   tree->ResetBranchAddresses();
    return graphs;
 }
 
@@ -285,13 +720,12 @@ bool CheckPerformance(PTData& newdata) {
    // Check whether the new performance measurements are within allowed parameters.
    // Return false on test failure (i.e. a significant performance decrease).
 
-   if (newdata.statEntries < 2) return true;
-
    for (int i = 0; i < kNumMeasurements; ++i) {
+      if (!newdata.Has(i) || newdata.Entries(i) < 2) continue;
       PTVal* val = newdata.pval[i];
-      double var = val->fVar + uncertainty[i];
-      val->fZ = (val->fVal - val->fMean) / var;
-      if (val->fVal > val->fMean + zLimits[i] * var) {
+      double sigma = val->Sigma() + uncertainty[i];
+      val->fZ = (val->fVal - val->fMedian) / sigma;
+      if (val->fZ > zLimits[i]) {
          newdata.outlier |= 1 << i;
       }
    }
@@ -301,8 +735,10 @@ bool CheckPerformance(PTData& newdata) {
 //______________________________________________________________________________
 void UpdateGraphs(PTGraphColl* graphs, const PTData& newdata) {
    for (int i = 0; i < kNumMeasurements; ++i) {
-      FillGraphEntry(i, *(graphs->gr[i]), *newdata.pval[i], newdata.statEntries,
-                     newdata.svn, newdata.outlier);
+      if (newdata.Has(i)) {
+         FillGraphEntry(i, *(graphs->gr[i]), *newdata.pval[i],
+                        newdata.svn, newdata.outlier);
+      }
       graphs->gr[i]->good->Set(graphs->gr[i]->nGood);
       graphs->gr[i]->bad->Set(graphs->gr[i]->nBad);
       graphs->gr[i]->limit->Set(graphs->gr[i]->nLimit);
@@ -310,97 +746,88 @@ void UpdateGraphs(PTGraphColl* graphs, const PTData& newdata) {
 }
 
 //______________________________________________________________________________
-void RevertOutlierStat(TTree* tree, const PTData& prevdata, PTData& newdata) {
-   // The new measurement is an outlier; update its integrated statistics data
-   // to not take the current measurement into account.
-
-   // Whether the previous is outlier or not, it contains the relevant
-   // average / variance etc data.
+void RevertOutlierStat(PTData& newdata) {
+   // The new measurement is an outlier; do not count it. The baseline
+   // statistics never include the current measurement.
 
    --newdata.statEntries;
+   for (int p = 0; p < kPTNumPhases; ++p) {
+      if (newdata.phases & (1 << p)) --newdata.phaseEntries[p];
+   }
+   for (int c = 0; c < kPTNumCounters; ++c) {
+      if (newdata.counters & (1 << c)) --newdata.counterEntries[c];
+   }
+}
 
-   for (int i = 0; i < kNumMeasurements; ++i) {
-      PTVal* nval = newdata.pval[i];
-      const PTVal* pval = prevdata.pval[i];
-      nval->fMean = pval->fMean;
-      nval->fVar = pval->fVar;
-      nval->fSumVal2 = pval->fSumVal2;
+//______________________________________________________________________________
+void ReportAllocSiteChanges(const PTData& olddata, const PTData& newdata,
+                            unsigned int maxSites = 10) {
+   // Print the call sites whose (extrapolated) allocated bytes grew most
+   // between olddata and newdata.
+
+   if (!newdata.allocSampleInterval) {
+      cout << "   No allocation call sites recorded; set PT_ALLOCSAMPLE=N to sample every Nth allocation." << endl;
+      return;
    }
+
+   std::map<TString, double> delta; // kB
+   for (size_t i = 0; i < newdata.allocSites.size(); ++i) {
+      const PTAllocSite& site = newdata.allocSites[i];
+      delta[site.fSite] += site.fBytes * (double)newdata.allocSampleInterval / 1024.;
+   }
+   for (size_t i = 0; i < olddata.allocSites.size(); ++i) {
+      const PTAllocSite& site = olddata.allocSites[i];
+      delta[site.fSite] -= site.fBytes * (double)olddata.allocSampleInterval / 1024.;
+   }
+
+   std::vector<std::pair<double, TString> > sorted;
+   for (std::map<TString, double>::const_iterator i = delta.begin(); i != delta.end(); ++i)
+      if (i->second > 0.)
+         sorted.push_back(std::make_pair(i->second, i->first));
+   std::sort(sorted.rbegin(), sorted.rend());
+   if (sorted.size() > maxSites)
+      sorted.resize(maxSites);
+
+   cout << "   Call sites allocating more than in revision " << olddata.svn
+        << " (kB, sampling every " << newdata.allocSampleInterval << " allocations):" << endl;
+   for (size_t i = 0; i < sorted.size(); ++i)
+      cout << "   +" << sorted[i].first << "\t" << sorted[i].second << endl;
 }
 
 //______________________________________________________________________________
-void ReportFailures(const PTData& newdata, const TString& testName,
-                    const TString& fileName) {
+void ReportFailures(const PTData& olddata, const PTData& newdata,
+                    const TString& testName, const TString& fileName) {
 
    for (int i = 0; i < kNumMeasurements; ++i) {
       if (newdata.outlier & (1 << i)) {
          cout << "Performance decrease (" << measurementNames[i] << ") for test " << testName << " in file " << fileName << endl;
          cout << "   Measured: " << newdata.pval[i]->fVal << endl
-              << "   Mean: " << newdata.pval[i]->fMean << endl
-              << "   Variance: " << newdata.pval[i]->fVar << endl
+              << "   Median: " << newdata.pval[i]->fMedian << endl
+              << "   Sigma (from MAD): " << newdata.pval[i]->Sigma() << endl
               << "   Delta: " << newdata.pval[i]->fZ << "sigmas" << endl;
+         if (newdata.pval[i]->fChangeRev)
+            cout << "   Baseline since level shift at revision " << newdata.pval[i]->fChangeRev << endl;
+         if (i == kMemAlloc && olddata.statEntries)
+            ReportAllocSiteChanges(olddata, newdata);
       }
    }
 }
 
 //______________________________________________________________________________
-void UpdateTree(TTree* tree, const PTData& newdata) {
-   const PTData *localptr = &newdata;
-   tree->SetBranchAddress("event",&localptr);
-   tree->Fill();
-   tree->Write(0, TObject::kWriteDelete);
-   TFile* file = tree->GetCurrentFile();
-   delete tree;
-   delete file;
-}
-
-//______________________________________________________________________________
-void DeleteOldEntries(TTree *&tree, unsigned int historyThinningCounter, const TString& fileName)
-{
-   // Delete old entries, to not collect too much historical data.
-
-   static const int ExpTime=200; // 2*ExpTime values (not including outliers) stored in tree int status;
-   if (historyThinningCounter % ExpTime != 0) return;
-
-   PTData *data = 0;
-   tree->SetBranchAddress("event",&data);
-   TString tmpFileName(fileName);
-   tmpFileName.ReplaceAll(".root", "_tmp.root");
-   TFile::Open(tmpFileName, "RECREATE");
-   TTree* newT = tree->CloneTree(0);
-   ULong64_t nevent = tree->GetEntries();
-   ULong64_t newStatEntries = 0;
-   for (ULong64_t i = 0; i < nevent; i++){
-      tree->GetEntry(i);
-      if (data->outlier != 0) {
-         newT->Fill();
-         continue;
-      }
-      if (newStatEntries % 2 == 0) {
-         // Let every 2nd entry survive
-         ++newStatEntries;
-         // Set stat entries to the current number of entries
-         // Gives new entries after history deletion more weight
-         data->statEntries = newStatEntries;
-
-         newT->Fill();
-      }
-   }
-   TFile* fileOld = tree->GetCurrentFile();
-   delete tree;
-   delete fileOld;
-   gSystem->Unlink(fileName);
-   gSystem->Rename(tmpFileName, fileName);
-   tree = newT;
-   tree->ResetBranchAddresses();
-}
-
-//______________________________________________________________________________
-void SaveGraphs(PTGraphColl* graphs, const TString& dataFileName, const TString& testName)
+void SaveGraphs(PTGraphColl* graphs, const TString& imageName, const TString& testName)
 {
    // Save the graphs into a canvas.
 
-   TCanvas *c1 = new TCanvas("c1","Performance Monitoring Plots",1200,800);
+   // Only show what was measured: phases are optional.
+   int shown[kNumMeasurements];
+   int nShown = 0;
+   for (int i = 0; i < kNumMeasurements; ++i) {
+      if (graphs->gr[i]->nGood + graphs->gr[i]->nBad > 0)
+         shown[nShown++] = i;
+   }
+   int nRows = (nShown + 1) / 2;
+
+   TCanvas *c1 = new TCanvas("c1","Performance Monitoring Plots",1200,TMath::Max(800, 200 * nRows));
    TText* title = new TText(.1, .95, testName);
    title->SetTextFont((title->GetTextFont() / 10) * 10 + 3); // scalable, pixels
    title->SetTextSizePixels(24);
@@ -412,10 +839,11 @@ void SaveGraphs(PTGraphColl* graphs, const TString& dataFileName, const TString&
                              1., .92,
                              -1, 0, 0);
    graphPad->Draw();
-   graphPad->Divide(2, (kNumMeasurements + 1) / 2, 0.);
+   graphPad->Divide(2, nRows, 0.);
    TList listMG;
    listMG.SetOwner();
-   for (int i = 0; i < kNumMeasurements; ++i) {
+   for (int iShown = 0; iShown < nShown; ++iShown) {
+      int i = shown[iShown];
       graphs->gr[i]->good->SetMarkerColor(kBlack);
       graphs->gr[i]->good->SetMarkerStyle(kCircle); // 7 probably faster (not scalable)
       graphs->gr[i]->good->SetLineColor(kBlack);
@@ -445,7 +873,7 @@ void SaveGraphs(PTGraphColl* graphs, const TString& dataFileName, const TString&
          mg->Add(graphs->gr[i]->good, "LP");
       mg->SetTitle(measurementNames[i]);
 
-      graphPad->cd(i + 1);
+      graphPad->cd(iShown + 1);
       mg->Draw("A");
       gPad->Update();
       gPad->SetGrid();
@@ -463,22 +891,124 @@ void SaveGraphs(PTGraphColl* graphs, const TString& dataFileName, const TString&
       }
       gPad->Update();
    }
-   TString imageName(dataFileName);
-   imageName.ReplaceAll(".root", ".gif");
    gErrorIgnoreLevel = 3000; // No "Info:" message
    c1->SaveAs(imageName);
    gErrorIgnoreLevel = 0;
    delete c1;
 }
 
+//______________________________________________________________________________
+int DiffAllocSites(const TString& storeName, const TString& testName,
+                   unsigned int oldRev, unsigned int newRev)
+{
+   // Compare the allocation call sites of the last measurements of two
+   // revisions of a test in the store.
+
+   PTStoreLock lock(storeName, false);
+   TFile* file = TFile::Open(storeName, "READ");
+   TTree* tree = 0;
+   if (file) file->GetObject("PerftrackHistory", tree);
+   if (!tree) {
+      printf("Error pt_collector: could not read PerftrackHistory from %s\n", storeName.Data());
+      return 1;
+   }
+
+   std::vector<PTData> entries;
+   Long64_t hash = GetTestHash(testName);
+   std::vector<Long64_t> entryNumbers;
+   FindEntries(tree, hash, oldRev, oldRev, entryNumbers);
+   if (newRev != oldRev) FindEntries(tree, hash, newRev, newRev, entryNumbers);
+   ReadEntries(tree, &entryNumbers, &testName, entries);
+   delete file;
+
+   const PTData* olddata = 0;
+   const PTData* newdata = 0;
+   for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].svn == oldRev) olddata = &entries[i];
+      if (entries[i].svn == newRev) newdata = &entries[i];
+   }
+   if (!olddata || !newdata) {
+      printf("Error pt_collector: no measurement of %s for revision %u in %s\n",
+             testName.Data(), olddata ? newRev : oldRev, storeName.Data());
+      return 1;
+   }
+   ReportAllocSiteChanges(*olddata, *newdata, (unsigned int)-1);
+   return 0;
+}
+
+//______________________________________________________________________________
+int ListRegressions(const TString& storeName, unsigned int maxTests, int measurement)
+{
+   // List the maxTests tests whose latest measurement exceeds its baseline
+   // median the most, relative to that median, in one pass over the store.
+
+   if (measurement < 0 || measurement >= kNumMeasurements) {
+      printf("Error pt_collector: measurement must be within [0, %d)\n", kNumMeasurements);
+      return 1;
+   }
+
+   PTStoreLock lock(storeName, false);
+   TFile* file = TFile::Open(storeName, "READ");
+   TTree* tree = 0;
+   if (file) file->GetObject("PerftrackHistory", tree);
+   if (!tree) {
+      printf("Error pt_collector: could not read PerftrackHistory from %s\n", storeName.Data());
+      return 1;
+   }
+
+   TString name;
+   PTData data;
+   TString* branchName = &name;
+   PTData* branchdata = &data;
+   tree->SetBranchAddress("test", &branchName);
+   tree->SetBranchAddress("event", &branchdata);
+
+   // Entries are appended in time order: the last one of each test wins.
+   std::map<TString, PTVal> latest;
+   std::map<TString, unsigned int> latestRev;
+   for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+      tree->GetEntry(entry);
+      if (!data.Has(measurement)) continue;
+      latest[name] = *data.pval[measurement];
+      latestRev[name] = data.svn;
+   }
+   tree->ResetBranchAddresses();
+   delete file;
+
+   std::vector<std::pair<double, TString> > sorted;
+   for (std::map<TString, PTVal>::const_iterator i = latest.begin(); i != latest.end(); ++i) {
+      if (i->second.fMedian > 0.)
+         sorted.push_back(std::make_pair(i->second.fVal / i->second.fMedian - 1., i->first));
+   }
+   std::sort(sorted.rbegin(), sorted.rend());
+   if (sorted.size() > maxTests)
+      sorted.resize(maxTests);
+
+   printf("Largest regressions in %s of %lu tests:\n", measurementNames[measurement], latest.size());
+   printf("%8s %12s %12s %8s %10s  %s\n", "change", "measured", "median", "sigmas", "revision", "test");
+   for (size_t i = 0; i < sorted.size(); ++i) {
+      const PTVal& val = latest[sorted[i].second];
+      printf("%+7.1f%% %12.4g %12.4g %8.2f %10u  %s\n", 100. * sorted[i].first,
+             val.fVal, val.fMedian, val.fZ, latestRev[sorted[i].second], sorted[i].second.Data());
+   }
+   return 0;
+}
+
 //______________________________________________________________________________
 int main(int argc, char** argv)
 {
    TH1::AddDirectory(false);
 
+   if (argc == 6 && !strcmp(argv[1], "-allocdiff"))
+      return DiffAllocSites(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+   if ((argc == 4 || argc == 5) && !strcmp(argv[1], "-regressions"))
+      return ListRegressions(argv[2], atoi(argv[3]), argc == 5 ? atoi(argv[4]) : (int)kCPUTime);
+
    if (argc < 2) {
       printf("Error: insufficient number of arguments.\n"
-             "  pt_collector <ROOTTEST_HOME> program arguments...\n");
+             "  pt_collector <ROOTTEST_HOME> program arguments...\n"
+             "  pt_collector -allocdiff pt_history.root test_name old_revision new_revision\n"
+             "  pt_collector -regressions pt_history.root number_of_tests [measurement]\n");
       return 1;
    }
 
@@ -498,30 +1028,66 @@ int main(int argc, char** argv)
    setenv("PT_FIFONAME", fifoName, 1);
    mkfifo(fifoName, 0666);
 
+   // The child waits for the parent to attach the performance counters.
+   int syncPipe[2];
+   if (pipe(syncPipe) != 0) {
+      printf("Error pt_collector: cannot create pipe: %s\n", strerror(errno));
+      return 1;
+   }
+
    pid_t pid=fork();
-   if (pid == 0) InvokeChild(argv, roottestHome);
-   else {
-      PTMeasurement results = ReceiveResults(fifoName);
-      TString test;
-      TString file;
-      TTree* tree = GetTree(file, test, argc, argv, cwd, roottestHome);
+   if (pid == 0) {
+      close(syncPipe[1]);
+      char go;
+      ssize_t n;
+      while ((n = read(syncPipe[0], &go, 1)) < 0 && errno == EINTR)
+         {}
+      if (n != 1) {
+         printf("Error pt_collector: no go from the parent: %s\n", n < 0 ? strerror(errno) : "pipe closed");
+         fflush(stdout);
+         _exit(1);
+      }
+      close(syncPipe[0]);
+      InvokeChild(argv, roottestHome);
+   } else {
+      close(syncPipe[0]);
+      PTCounters counters;
+      counters.Open(pid);
+      ssize_t n;
+      while ((n = write(syncPipe[1], "g", 1)) < 0 && errno == EINTR)
+         {}
+      close(syncPipe[1]);
+      if (n != 1) {
+         // The child sees the pipe closed and exits.
+         printf("Error pt_collector: cannot start the child: %s\n", n < 0 ? strerror(errno) : "nothing written");
+         waitpid(pid, 0, 0);
+         unlink(fifoName);
+         return 1;
+      }
+
+      PTMeasurement results = ReceiveResults(fifoName, counters);
+      TString test = GetTestName(argc, argv, cwd, roottestHome);
+      TString store = GetStoreName(roottestHome);
+      std::vector<PTData> entries;
+      ReadHistory(store, test, entries);
       PTData olddata;
-      PTGraphColl* graphs = CreateOldGraphs(tree,olddata);
+      if (!entries.empty()) olddata = entries.back();
+      PTHistory history[kNumMeasurements];
+      PTGraphColl* graphs = CreateOldGraphs(entries, history);
       PTData newdata;
-      FillData(results, tree, olddata, newdata);
+      FillData(results, history, olddata, newdata);
       CheckPerformance(newdata);
 
       UpdateGraphs(graphs, newdata);
-      SaveGraphs(graphs, file, test);
+      SaveGraphs(graphs, GetTestFileName(test, ".gif"), test);
       delete graphs;
 
       if (newdata.outlier) {
-         ReportFailures(newdata, test, file);
-         RevertOutlierStat(tree, olddata, newdata);
+         ReportFailures(olddata, newdata, test, store);
+         RevertOutlierStat(newdata);
       }
 
-      DeleteOldEntries(tree, newdata.historyThinningCounter, file);
-      UpdateTree(tree, newdata);
+      AppendToStore(store, test, std::vector<PTData>(1, newdata));
    }
 }
 
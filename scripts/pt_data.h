@@ -1,80 +1,206 @@
 #include "TObject.h"
 #include "TString.h"
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+#include "pt_fifo.h"
 
 class PTVal: public TObject {
 public:
-   PTVal(): fVal(), fZ(), fMean(), fVar(), fSumVal2() {}
-   void Set(double val, const PTVal& prev, unsigned int newnum) {
-      *this = prev;
+   PTVal(): fVal(), fZ(), fMean(), fVar(), fMedian(), fMAD(), fChangeRev() {}
+
+   void Set(double val, const std::vector<double>& baseline, unsigned int changeRev) {
+      // Set the measurement and the statistics of the baseline it is compared
+      // to; the baseline does not include val.
       fVal = val;
-      fSumVal2 += val * val;
-      fMean = (fMean * (newnum - 1) + val) / newnum;
-      double var2 = fSumVal2 / newnum - fMean * fMean;
-      if (var2 > 0.) {
-         fVar = sqrt(var2);
-      } else {
-         fVar = 0.;
-      }
+      fZ = 0.;
+      fChangeRev = changeRev;
+      fMean = fVar = fMedian = fMAD = 0.;
+      if (baseline.empty()) return;
+
+      // Two passes: the one-pass sum of squares loses all precision for
+      // large values with small spread.
+      for (size_t i = 0; i < baseline.size(); ++i)
+         fMean += baseline[i];
+      fMean /= baseline.size();
+      for (size_t i = 0; i < baseline.size(); ++i)
+         fVar += (baseline[i] - fMean) * (baseline[i] - fMean);
+      fVar = sqrt(fVar / baseline.size());
+
+      fMedian = Median(baseline);
+      std::vector<double> absdev(baseline.size());
+      for (size_t i = 0; i < baseline.size(); ++i)
+         absdev[i] = fabs(baseline[i] - fMedian);
+      fMAD = Median(absdev);
+   }
+
+   double Sigma() const {
+      // Robust estimate of the standard deviation of the baseline.
+      return 1.4826 * fMAD; // for normally distributed values
+   }
+
+   static double Median(std::vector<double> v) {
+      if (v.empty()) return 0.;
+      size_t mid = v.size() / 2;
+      std::nth_element(v.begin(), v.begin() + mid, v.end());
+      if (v.size() % 2) return v[mid];
+      return (v[mid] + *std::max_element(v.begin(), v.begin() + mid)) / 2.;
    }
 
    double fVal; // Measurement
-   double fZ; // Deviation of fVal from fMean, in multiple of fVar
-   double fMean; // Average, including fVal
-   double fVar; // Variance, including fVal
-   double fSumVal2; // Sum of squared measurements, including fVal
-   ClassDef(PTVal, 1);
+   double fZ; // Deviation of fVal from fMedian, in multiples of Sigma() plus uncertainty
+   double fMean; // Average of the baseline, excluding fVal
+   double fVar; // Standard deviation of the baseline, excluding fVal
+   double fMedian; // Median of the baseline, excluding fVal
+   double fMAD; // Median absolute deviation of the baseline, excluding fVal
+   unsigned int fChangeRev; // Revision of the first measurement after the last level shift, 0 if none
+   ClassDef(PTVal, 2);
+};
+
+class PTAllocSite: public TObject {
+public:
+   PTAllocSite(): fNumAllocs(), fBytes() {}
+
+   TString fSite; // demangled frames, innermost first, separated by ';'
+   Long64_t fNumAllocs[kPTNumSizeBuckets]; // sampled allocations per size bucket, see PTSizeBucket()
+   Long64_t fBytes; // sampled bytes
+   ClassDef(PTAllocSite, 1);
+};
+
+// Hardware and software performance counters of the test process, where
+// the kernel provides them (perf_event_open).
+enum EPTCounter {
+   kPTInstructions,
+   kPTCycles,
+   kPTCacheMisses,
+   kPTBranchMisses,
+   kPTContextSwitches,
+   kPTNumCounters
 };
 
+// Number of PTVals in PTData: memleak, mempeak, memalloc, cputime, followed
+// by CPU time, wall time and RSS of each EPTPhase, and the EPTCounters.
+const int kPTNumBaseVals = 4;
+const int kPTNumPhaseVals = 3;
+const int kPTFirstCounterVal = kPTNumBaseVals + kPTNumPhaseVals * kPTNumPhases;
+const int kPTNumVals = kPTFirstCounterVal + kPTNumCounters;
+
 class PTData: public TObject {
 public:
-   PTData(): outlier(), svn(), statEntries(), historyThinningCounter()
+   PTData(): outlier(), svn(), statEntries(),
+             numAllocs(), allocSampleInterval(), phases(), phaseEntries(),
+             counters(), counterEntries()
    { PSet(); }
 
    PTData(const PTData& o):
       outlier(o.outlier),
       svn(o.svn),
       statEntries(o.statEntries),
-      historyThinningCounter(o.historyThinningCounter),
       date(o.date),
       memleak(o.memleak),
       mempeak(o.mempeak),
       memalloc(o.memalloc),
-      cputime(o.cputime)
-   { PSet(); }
+      cputime(o.cputime),
+      numAllocs(o.numAllocs),
+      threadMemPeak(o.threadMemPeak),
+      threadNumAllocs(o.threadNumAllocs),
+      allocSampleInterval(o.allocSampleInterval),
+      allocSites(o.allocSites),
+      phases(o.phases),
+      counters(o.counters)
+   { CopyArrays(o); PSet(); }
 
    PTData& operator=(const PTData& o) {
       outlier = o.outlier;
       svn = o.svn;
       statEntries = o.statEntries;
-      historyThinningCounter = o.historyThinningCounter;
       date = o.date;
       memalloc = o.memalloc;
       memleak = o.memleak;
       mempeak = o.mempeak;
       cputime = o.cputime;
+      numAllocs = o.numAllocs;
+      threadMemPeak = o.threadMemPeak;
+      threadNumAllocs = o.threadNumAllocs;
+      allocSampleInterval = o.allocSampleInterval;
+      allocSites = o.allocSites;
+      phases = o.phases;
+      counters = o.counters;
+      CopyArrays(o);
       PSet();
       return *this;
    }
 
+   void CopyArrays(const PTData& o) {
+      for (int i = 0; i < kPTNumPhases; ++i) {
+         phaseEntries[i] = o.phaseEntries[i];
+         phaseCPU[i] = o.phaseCPU[i];
+         phaseWall[i] = o.phaseWall[i];
+         phaseRSS[i] = o.phaseRSS[i];
+      }
+      for (int i = 0; i < kPTNumCounters; ++i) {
+         counterEntries[i] = o.counterEntries[i];
+         counter[i] = o.counter[i];
+      }
+   }
+
    void PSet() {
       pval[0] = &memleak;
       pval[1] = &mempeak;
       pval[2] = &memalloc;
       pval[3] = &cputime;
+      for (int i = 0; i < kPTNumPhases; ++i) {
+         pval[kPTNumBaseVals + kPTNumPhaseVals * i] = &phaseCPU[i];
+         pval[kPTNumBaseVals + kPTNumPhaseVals * i + 1] = &phaseWall[i];
+         pval[kPTNumBaseVals + kPTNumPhaseVals * i + 2] = &phaseRSS[i];
+      }
+      for (int i = 0; i < kPTNumCounters; ++i) {
+         pval[kPTFirstCounterVal + i] = &counter[i];
+      }
+   }
+
+   bool Has(int ival) const {
+      // Whether pval[ival] was measured.
+      if (ival < kPTNumBaseVals) return true;
+      if (ival >= kPTFirstCounterVal) return counters & (1 << (ival - kPTFirstCounterVal));
+      return phases & (1 << ((ival - kPTNumBaseVals) / kPTNumPhaseVals));
+   }
+
+   unsigned int& Entries(int ival) {
+      // Number of measurements in the averages of pval[ival], incl current.
+      if (ival < kPTNumBaseVals) return statEntries;
+      if (ival >= kPTFirstCounterVal) return counterEntries[ival - kPTFirstCounterVal];
+      return phaseEntries[(ival - kPTNumBaseVals) / kPTNumPhaseVals];
+   }
+   unsigned int Entries(int ival) const {
+      return const_cast<PTData*>(this)->Entries(ival);
    }
 
-   int outlier; // memalloc == 1 | memleak == 2 | mempeak == 4 | cputime == 8
+   int outlier; // bit i set if pval[i] is an outlier
    unsigned int svn; // ROOT svn revision
-   unsigned int statEntries; // number of measurements in averages etc, incl current
-   unsigned int historyThinningCounter; // counter for deletion of old entries
+   unsigned int statEntries; // number of non-outlier measurements, incl current
    TString date;
    PTVal memleak;
    PTVal mempeak;
    PTVal memalloc;
    PTVal cputime;
+   Long64_t numAllocs; // number of allocations
+   std::vector<double> threadMemPeak; // per-thread peak memory usage (kB)
+   std::vector<Long64_t> threadNumAllocs; // per-thread number of allocations
+   unsigned int allocSampleInterval; // every how many allocations allocSites were sampled; 0 if not sampled
+   std::vector<PTAllocSite> allocSites; // sampled allocations per call site
+   int phases; // bit i set if EPTPhase i was measured
+   unsigned int phaseEntries[kPTNumPhases]; // like statEntries, per phase
+   PTVal phaseCPU[kPTNumPhases]; // CPU time per phase (s)
+   PTVal phaseWall[kPTNumPhases]; // wall time per phase (s)
+   PTVal phaseRSS[kPTNumPhases]; // resident set size at the end of each phase (kB)
+   int counters; // bit i set if EPTCounter i was measured
+   unsigned int counterEntries[kPTNumCounters]; // like statEntries, per counter
+   PTVal counter[kPTNumCounters]; // counts (millions of instructions, cycles; thousands of misses; context switches)
 
-   PTVal* pval[4]; //!
+   PTVal* pval[kPTNumVals]; //!
 
-   ClassDef(PTData,1)
+   ClassDef(PTData,7)
 }; 
     
@@ -0,0 +1,80 @@
+#ifndef PT_FIFO_H
+#define PT_FIFO_H
+
+// Layout of the statistics record that ptpreload.so (pt_mymalloc.cpp) writes
+// into the FIFO named by PT_FIFONAME, and that pt_collector reads back.
+//
+// The record starts with kPTNumHeaderEntries longs (see EPTFifoHeader),
+// followed by header[kPTNumThreads] PTThreadRecord, one per thread that
+// allocated memory, header[kPTNumPhaseRecords] PTPhaseRecord and
+// header[kPTNumCallSites] PTCallSiteRecord. The first four longs are laid out
+// as they always were.
+
+// Marks a valid record.
+const long kPTFifoTag = 699692586;
+
+// Number of threads with their own statistics slot; any further threads
+// share the last slot.
+const int kPTMaxThreadSlots = 256;
+
+enum EPTFifoHeader {
+   kPTCurrentHeap, // bytes allocated and not freed at exit, i.e. leaked
+   kPTMaxHeap,     // peak of allocated bytes, process wide
+   kPTSumAllocs,   // sum of all allocated bytes
+   kPTTag,         // kPTFifoTag
+   kPTNumAllocs,   // number of allocations
+   kPTNumThreads,  // number of PTThreadRecord following the header
+   kPTSampleInterval, // every how many allocations a thread samples; 0 if not sampling
+   kPTNumPhaseRecords, // number of PTPhaseRecord following the PTThreadRecords
+   kPTNumCallSites, // number of PTCallSiteRecord following the PTPhaseRecords
+   kPTNumHeaderEntries
+};
+
+struct PTThreadRecord {
+   long fMaxHeap;   // peak of bytes allocated minus bytes freed by this thread
+   long fSumAllocs; // sum of bytes allocated by this thread
+   long fNumAllocs; // number of allocations done by this thread
+};
+
+// Phases of a test's run, marked by the test through PTMarkPhase() (see
+// pt_phase.h). Everything up to the first mark is accounted as startup. If a
+// test marks no phase, no PTPhaseRecord is sent; otherwise one per phase.
+enum EPTPhase {
+   kPTPhaseStartup,
+   kPTPhaseCompile,
+   kPTPhaseSetup,
+   kPTPhaseWorkload,
+   kPTPhaseTeardown,
+   kPTNumPhases
+};
+
+struct PTPhaseRecord {
+   long fEntered;  // how often the phase was entered; 0 if it was not measured
+   long fCPUTime;  // user + system time of the process spent in the phase (us)
+   long fWallTime; // wall clock time spent in the phase (us)
+   long fRSS;      // largest resident set size at the end of the phase (bytes)
+};
+
+// Allocation sampling, enabled by setting the env var PT_ALLOCSAMPLE to N:
+// each thread records the call site and size of every Nth allocation.
+const int kPTMaxCallSites = 512;   // distinct call sites recorded
+const int kPTCallSiteDepth = 4;    // stack frames identifying a call site
+const int kPTCallSiteLen = 512;    // length of a symbolized call site
+const int kPTNumSizeBuckets = 16;  // see PTSizeBucket()
+
+inline int PTSizeBucket(unsigned long size) {
+   // Bucket 0 holds sizes below 16 bytes, bucket i sizes in [2^(i+3), 2^(i+4)),
+   // the last bucket everything above.
+   int bucket = 0;
+   for (size >>= 4; size && bucket < kPTNumSizeBuckets - 1; size >>= 1)
+      ++bucket;
+   return bucket;
+}
+
+struct PTCallSiteRecord {
+   long fNumAllocs[kPTNumSizeBuckets]; // sampled allocations per size bucket
+   long fBytes; // sampled bytes
+   char fSite[kPTCallSiteLen]; // frames, innermost first, separated by ';'
+};
+
+#endif // PT_FIFO_H
@@ -7,26 +7,74 @@
 #else
 #include <malloc.h>
 #endif
-#include <pthread.h>
+#include <atomic>
+#include <execinfo.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "pt_fifo.h"
+
 // Intercepts calls to malloc, realloc, free, by planting replacement symbols.
 // This library is meant to be LD_PRELOAD'ed to do its job.
 //
 // Collects statistics and pipes them back through a FIFO specified in the
-// env var PT_FIFONAME.
+// env var PT_FIFONAME; see pt_fifo.h for the record layout.
 //
 // Manipulates allocations by prepending a TAG value of size int and the size of
 // the allocation (size_t).
 //
-// The initialization of the counting structures and forwarding function pointers
-// happens upon the first call to malloc / realloc / free; this assumes that no
-// threads have been created before the first call to malloc / realloc / free.
+// Statistics are collected without locks: each thread counts into its own slot,
+// and the slots are merged when the process exits. The process wide peak is
+// tracked through an atomic counter; as soon as a second thread allocates,
+// each thread only folds its heap changes into it in batches of kFlushBytes,
+// which makes the peak exact to within kFlushBytes per thread.
+//
+// If the env var PT_ALLOCSAMPLE is set to N > 0, every Nth allocation of each
+// thread is sampled: its call site (the innermost frames outside of this
+// library and operator new) and size bucket are counted in a fixed-size table
+// that is symbolized and sent along with the statistics at exit.
+//
+// Tests can mark phases of their run through PTMarkPhase() from pt_phase.h,
+// which calls PerfTrackMarkPhase(); CPU time, wall time and resident set size
+// are then accounted per phase.
+//
+// The initialization of the forwarding function pointers happens upon the
+// first call to malloc / realloc / free.
 //
 
+namespace {
+   // Statistics of one thread. Only the owning thread updates them, except
+   // for the last slot which is shared by all threads that did not get their
+   // own. Aligned to avoid false sharing between threads.
+   struct alignas(64) PTThreadSlot {
+      std::atomic<long> fCurrentHeap;
+      std::atomic<long> fMaxHeap;
+      std::atomic<long> fSumAllocs;
+      std::atomic<long> fNumAllocs;
+   };
+
+   // A sampled call site; fFrames[0] == 0 marks an unused entry.
+   struct PTCallSite {
+      void* fFrames[kPTCallSiteDepth];
+      long fNumAllocs[kPTNumSizeBuckets];
+      long fBytes;
+   };
+
+   // The calling thread's slot, and its heap changes not yet folded into the
+   // process wide counter. Must be initial-exec: accessing a dynamic TLS
+   // variable can call malloc.
+   __thread PTThreadSlot* gThreadSlot __attribute__((tls_model("initial-exec"))) = 0;
+   __thread long gPendingHeap __attribute__((tls_model("initial-exec"))) = 0;
+   // Allocations until the calling thread takes its next sample, and whether
+   // it is currently taking one (backtrace() itself can allocate).
+   __thread long gSampleCountdown __attribute__((tls_model("initial-exec"))) = 0;
+   __thread bool gInSample __attribute__((tls_model("initial-exec"))) = false;
+}
+
 class PerfTrackMallocInterposition {
 public:
    static PerfTrackMallocInterposition& Instance() {
@@ -37,25 +85,22 @@ public:
    void* Malloc(size_t size);
    void* Realloc(void* ptr, size_t size);
    void  Free(void* ptr);
+   void  MarkPhase(int phase);
 
 private:
-   // Statistics elements
-   enum EPerfDataType {
-      kPDCurrentHeap,
-      kPDMaxHeap,
-      kPDSumAllocs,
-      kPDTag,
-      kNumPerfDataTypes
+   enum {
+      kFlushBytes = 64 * 1024 // batch size for updates of fCurrentHeap
    };
 
-   PerfTrackMallocInterposition(): fFifoFD(-1), fPerfData() {
-      // Initialize data structures, mutex, fifo.
+   PerfTrackMallocInterposition(): fFifoFD(-1), fSlots(), fNumSlots(0),
+                                   fCurrentHeap(0), fMaxHeap(0),
+                                   fSampleInterval(0), fOwnBase(0), fSites(),
+                                   fPhases(), fCurrentPhase(-1), fPhaseStartCPU(0) {
+      // Initialize forwarding functions, fifo.
       SetFunc((void**)&fPMalloc, "malloc");
       SetFunc((void**)&fPRealloc, "realloc");
       SetFunc((void**)&fPFree, "free");
 
-      pthread_mutex_init(&fgPTMutex, 0);
-
       static char envPreload[] = "LD_PRELOAD=";
       putenv(envPreload);
 
@@ -70,15 +115,71 @@ private:
       } else {
          printf("%s:%d: %s not set: %s\n", __FILE__, __LINE__, fifoenv, strerror(errno)); 
       }
-      fPerfData[kPDTag]=699692586; // for collector to know that stored values are valid
+
+      const char* sampleenv = getenv("PT_ALLOCSAMPLE");
+      if (sampleenv)
+         fSampleInterval = atol(sampleenv);
+      if (fSampleInterval < 0)
+         fSampleInterval = 0;
+      fSitesLock.clear();
+
+      // Approximates the process start, the beginning of the startup phase.
+      fPhaseStartWall = WallTime();
    }
 
    ~PerfTrackMallocInterposition() {
-      // Tear down.
-      pthread_mutex_destroy(&fgPTMutex);
+      // Merge the per-thread statistics and send them to the collector.
+      if (fFifoFD < 0) return;
+
+      long header[kPTNumHeaderEntries] = {};
+      PTThreadRecord threads[kPTMaxThreadSlots];
+      int nThreads = fNumSlots.load();
+      if (nThreads > kPTMaxThreadSlots)
+         nThreads = kPTMaxThreadSlots;
+      for (int i = 0; i < nThreads; ++i) {
+         const PTThreadSlot& slot = fSlots[i];
+         threads[i].fMaxHeap = slot.fMaxHeap.load();
+         threads[i].fSumAllocs = slot.fSumAllocs.load();
+         threads[i].fNumAllocs = slot.fNumAllocs.load();
+         header[kPTCurrentHeap] += slot.fCurrentHeap.load();
+         header[kPTSumAllocs] += threads[i].fSumAllocs;
+         header[kPTNumAllocs] += threads[i].fNumAllocs;
+      }
+      // Other threads' pending changes never made it into fCurrentHeap, but
+      // the sum of the per-thread heaps is exact.
+      header[kPTMaxHeap] = fMaxHeap.load();
+      if (header[kPTCurrentHeap] > header[kPTMaxHeap])
+         header[kPTMaxHeap] = header[kPTCurrentHeap];
+      header[kPTTag] = kPTFifoTag; // for collector to know that stored values are valid
+      header[kPTNumThreads] = nThreads;
+      header[kPTSampleInterval] = fSampleInterval;
+      if (fCurrentPhase >= 0) {
+         MarkPhase(-1); // end the current phase
+         header[kPTNumPhaseRecords] = kPTNumPhases;
+      }
+      for (int i = 0; i < kPTMaxCallSites; ++i)
+         if (fSites[i].fFrames[0])
+            ++header[kPTNumCallSites];
 
-      if (fFifoFD >= 0 && write(fFifoFD, &fPerfData, sizeof(fPerfData))==-1)
+      if (write(fFifoFD, header, sizeof(header)) == -1
+          || write(fFifoFD, threads, nThreads * sizeof(PTThreadRecord)) == -1
+          || write(fFifoFD, fPhases, header[kPTNumPhaseRecords] * sizeof(PTPhaseRecord)) == -1) {
          printf("%s:%d: Error writing statistics to fifo: %s\n", __FILE__, __LINE__, strerror(errno)); 
+         return;
+      }
+
+      PTCallSiteRecord record;
+      for (int i = 0; i < kPTMaxCallSites; ++i) {
+         const PTCallSite& site = fSites[i];
+         if (!site.fFrames[0]) continue;
+         memcpy(record.fNumAllocs, site.fNumAllocs, sizeof(record.fNumAllocs));
+         record.fBytes = site.fBytes;
+         SymbolizeCallSite(site, record.fSite, sizeof(record.fSite));
+         if (write(fFifoFD, &record, sizeof(record)) == -1) {
+            printf("%s:%d: Error writing call sites to fifo: %s\n", __FILE__, __LINE__, strerror(errno)); 
+            return;
+         }
+      }
    }
 
    void SetFunc(void** ppFunc, const char* name) const {
@@ -91,12 +192,181 @@ private:
       }
    }
 
-   void IncHeap(size_t size) {
-      // Increase our heap statistics counter.
-      fPerfData[kPDCurrentHeap] += size; // heap
-      fPerfData[kPDSumAllocs] += size; // only allocs
-      if (fPerfData[kPDCurrentHeap] > fPerfData[kPDMaxHeap])
-         fPerfData[kPDMaxHeap] = fPerfData[kPDCurrentHeap];
+   PTThreadSlot& ThreadSlot() {
+      // Return the statistics slot of the calling thread, assigning one
+      // upon its first allocation.
+      if (!gThreadSlot) {
+         int slot = fNumSlots.fetch_add(1, std::memory_order_relaxed);
+         if (slot >= kPTMaxThreadSlots)
+            slot = kPTMaxThreadSlots - 1;
+         gThreadSlot = &fSlots[slot];
+      }
+      return *gThreadSlot;
+   }
+
+   void UpdateProcessHeap(long size) {
+      // Fold the heap change into the process wide counter and update the
+      // peak. Done for each call while only one thread allocates, in batches
+      // of kFlushBytes otherwise.
+      gPendingHeap += size;
+      if (fNumSlots.load(std::memory_order_relaxed) > 1
+          && gPendingHeap < kFlushBytes && gPendingHeap > -kFlushBytes)
+         return;
+      long heap = fCurrentHeap.fetch_add(gPendingHeap, std::memory_order_relaxed) + gPendingHeap;
+      gPendingHeap = 0;
+      long peak = fMaxHeap.load(std::memory_order_relaxed);
+      while (heap > peak
+             && !fMaxHeap.compare_exchange_weak(peak, heap, std::memory_order_relaxed))
+         {}
+   }
+
+   void IncHeap(long size) {
+      // Increase our heap statistics counter for a new allocation.
+      GrowHeap(size);
+      ThreadSlot().fNumAllocs.fetch_add(1, std::memory_order_relaxed);
+      if (fSampleInterval && size > 0 && --gSampleCountdown <= 0) {
+         gSampleCountdown = fSampleInterval;
+         SampleAllocation(size);
+      }
+   }
+
+   void GrowHeap(long size) {
+      // Increase our heap statistics counter by size bytes, allocated
+      // anew or by growing a block.
+      PTThreadSlot& slot = ThreadSlot();
+      long heap = slot.fCurrentHeap.fetch_add(size, std::memory_order_relaxed) + size;
+      // Threads beyond kPTMaxThreadSlots share the last slot.
+      long peak = slot.fMaxHeap.load(std::memory_order_relaxed);
+      while (heap > peak
+             && !slot.fMaxHeap.compare_exchange_weak(peak, heap, std::memory_order_relaxed))
+         {}
+      slot.fSumAllocs.fetch_add(size, std::memory_order_relaxed); // only allocs
+      UpdateProcessHeap(size);
+   }
+
+   static long CPUTime() {
+      // User plus system time of the process, in microseconds.
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+   }
+
+   static long WallTime() {
+      // Monotonic wall clock, in microseconds.
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+   }
+
+   static long ResidentSetSize() {
+      // Current resident set size in bytes; the peak one where /proc is not
+      // available. Must not allocate.
+#if defined(__linux__)
+      char buf[128];
+      int fd = open("/proc/self/statm", O_RDONLY);
+      if (fd >= 0) {
+         ssize_t n = read(fd, buf, sizeof(buf) - 1);
+         close(fd);
+         long pages = 0;
+         if (n > 0) {
+            buf[n] = 0;
+            const char* pos = strchr(buf, ' ');
+            if (pos && sscanf(pos, "%ld", &pages) == 1)
+               return pages * sysconf(_SC_PAGESIZE);
+         }
+      }
+#endif
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+      return usage.ru_maxrss; // bytes
+#else
+      return usage.ru_maxrss * 1024L; // kB
+#endif
+   }
+
+   bool IsAllocatorFrame(void* frame) const {
+      // Whether frame is in this library or in operator new, i.e. not the
+      // allocation's call site.
+      Dl_info info;
+      if (!dladdr(frame, &info)) return false;
+      if (info.dli_fbase == fOwnBase) return true;
+      return info.dli_sname && info.dli_sname[0] == '_' && info.dli_sname[1] == 'Z'
+         && info.dli_sname[2] == 'n' && (info.dli_sname[3] == 'w' || info.dli_sname[3] == 'a');
+   }
+
+   void SampleAllocation(long size) {
+      // Count the allocation for its call site.
+      if (gInSample) return;
+      gInSample = true;
+      if (!fOwnBase) {
+         Dl_info info;
+         if (dladdr((void*)&malloc, &info))
+            fOwnBase = info.dli_fbase;
+      }
+
+      void* frames[kPTCallSiteDepth + 8];
+      int nFrames = backtrace(frames, kPTCallSiteDepth + 8);
+      int first = 0;
+      while (first < nFrames && IsAllocatorFrame(frames[first]))
+         ++first;
+      if (first < nFrames) {
+         PTCallSite key = {};
+         for (int i = 0; i < kPTCallSiteDepth && first + i < nFrames; ++i)
+            key.fFrames[i] = frames[first + i];
+
+         unsigned long hash = 0;
+         for (int i = 0; i < kPTCallSiteDepth; ++i)
+            hash = hash * 31 + ((unsigned long)key.fFrames[i] >> 2);
+
+         while (fSitesLock.test_and_set(std::memory_order_acquire))
+            {}
+         // Linear probing; samples of new call sites get dropped once the table is full.
+         for (int probe = 0; probe < kPTMaxCallSites; ++probe) {
+            PTCallSite& site = fSites[(hash + probe) % kPTMaxCallSites];
+            if (!site.fFrames[0])
+               memcpy(site.fFrames, key.fFrames, sizeof(key.fFrames));
+            else if (memcmp(site.fFrames, key.fFrames, sizeof(key.fFrames)))
+               continue;
+            ++site.fNumAllocs[PTSizeBucket(size)];
+            site.fBytes += size;
+            break;
+         }
+         fSitesLock.clear(std::memory_order_release);
+      }
+      gInSample = false;
+   }
+
+   static void SymbolizeCallSite(const PTCallSite& site, char* buf, size_t len) {
+      // Write the call site's frames as (mangled) function names, or as
+      // library+offset where no symbol is known, separated by ';'.
+      buf[0] = 0;
+      size_t pos = 0;
+      for (int i = 0; i < kPTCallSiteDepth && site.fFrames[i] && pos < len; ++i) {
+         Dl_info info;
+         int n;
+         bool found = dladdr(site.fFrames[i], &info);
+         if (found && info.dli_sname)
+            n = snprintf(buf + pos, len - pos, "%s%s", i ? ";" : "", info.dli_sname);
+         else if (found && info.dli_fname) {
+            const char* lib = strrchr(info.dli_fname, '/');
+            n = snprintf(buf + pos, len - pos, "%s%s+0x%lx", i ? ";" : "",
+                         lib ? lib + 1 : info.dli_fname,
+                         (unsigned long)((char*)site.fFrames[i] - (char*)info.dli_fbase));
+         } else
+            n = snprintf(buf + pos, len - pos, "%s%p", i ? ";" : "", site.fFrames[i]);
+         if (n < 0) break;
+         pos += n;
+      }
+   }
+
+   void DecHeap(long size) {
+      // Decrease our heap statistics counter. Memory freed by a different
+      // thread than the one that allocated it is accounted to the freeing
+      // thread.
+      ThreadSlot().fCurrentHeap.fetch_sub(size, std::memory_order_relaxed);
+      UpdateProcessHeap(-size);
    }
 
    void* (*fPMalloc)(size_t);
@@ -104,20 +374,28 @@ private:
    void  (*fPFree)(void*);
 
    int fFifoFD; // file decriptor of FIFO
-   long fPerfData[kNumPerfDataTypes]; // statistics data
-   static pthread_mutex_t fgPTMutex; // protects statistics in multithreaded.
+   PTThreadSlot fSlots[kPTMaxThreadSlots]; // per-thread statistics
+   std::atomic<int> fNumSlots; // number of slots handed out, can exceed kPTMaxThreadSlots
+   std::atomic<long> fCurrentHeap; // process wide heap, see UpdateProcessHeap()
+   std::atomic<long> fMaxHeap; // process wide peak of fCurrentHeap
+
+   long fSampleInterval; // sample every this many allocations per thread, 0: off
+   void* fOwnBase; // load address of this library
+   PTCallSite fSites[kPTMaxCallSites]; // sampled call sites, hashed by frames
+   std::atomic_flag fSitesLock; // protects fSites; only taken when sampling
+
+   PTPhaseRecord fPhases[kPTNumPhases]; // per-phase statistics
+   int fCurrentPhase; // phase being measured, -1 before the first mark
+   long fPhaseStartCPU; // CPUTime() at the start of the current phase
+   long fPhaseStartWall; // WallTime() at the start of the current phase
 };
 
-pthread_mutex_t PerfTrackMallocInterposition::fgPTMutex = PTHREAD_MUTEX_INITIALIZER;
-
 void* PerfTrackMallocInterposition::Malloc(size_t size) {
    // Malloc with statistics
-   pthread_mutex_lock(&fgPTMutex);
    char* result = (char *)(*fPMalloc)(size+sizeof(int)+sizeof(size_t));
    IncHeap(size);
-   pthread_mutex_unlock(&fgPTMutex);
-   
-   *(int *)result=699692586;
+
+   *(int *)result=kPTFifoTag;
    *(size_t *)(result+sizeof(int))=size;
 
    return (void*) (result+sizeof(int)+sizeof(size_t));
@@ -126,15 +404,14 @@ void* PerfTrackMallocInterposition::Malloc(size_t size) {
 void* PerfTrackMallocInterposition::Realloc(void* ptr, size_t size) {
    // Realloc with statistics
   char *result;
-  int v1=699692586;
+  int v1=kPTFifoTag;
   if (ptr!=0) v1=*(int *) ((char*)ptr-sizeof(int)-sizeof(size_t));
 
-  pthread_mutex_lock(&fgPTMutex);
-  if (v1!=699692586 || ptr==0){ 
+  if (v1!=kPTFifoTag || ptr==0){ 
     if (ptr==0 && size!=0){ // behaves as malloc   
-       IncHeap(size);
+      IncHeap(size);
       result=(char *)(*fPRealloc)(0,size+sizeof(int)+sizeof(size_t));       
-      *(int *)result=699692586;
+      *(int *)result=kPTFifoTag;
       *(size_t *)(result+sizeof(int))=size;
     }
     else {
@@ -145,21 +422,21 @@ void* PerfTrackMallocInterposition::Realloc(void* ptr, size_t size) {
     {
       size_t v2=*(size_t *) ((char*)ptr-sizeof(size_t));
       if (size==0){ // behaves as free
-	fPerfData[kPDCurrentHeap]-=v2;
+	DecHeap(v2);
 	result=(char *)(*fPRealloc)((char*)ptr-sizeof(int)-sizeof(size_t),0);
       }
       else{
-         IncHeap(size-v2);
-		 
+	// Resizing is not a new allocation.
+	if (size>v2) GrowHeap((long)size-(long)v2);
+	else if (size<v2) DecHeap((long)v2-(long)size);
+
 	result = (char *)(*fPRealloc)((char*)ptr-sizeof(int)-sizeof(size_t),size+sizeof(int)+sizeof(size_t));
-	*(int *)result=699692586;
+	*(int *)result=kPTFifoTag;
 	*(size_t *)(result+sizeof(int))=size;
       }
     }
-		 
- pthread_mutex_unlock(&fgPTMutex); 
 
- if (v1!=699692586 || size==0) return (void*) (result); 
+ if (v1!=kPTFifoTag || size==0) return (void*) (result); 
   else return (void*) (result+sizeof(int)+sizeof(size_t)); 
 
 }
@@ -170,20 +447,38 @@ void PerfTrackMallocInterposition::Free(void* ptr) {
    if (ptr==0) return;
 
   int v1=*(int *) ((char*)ptr-sizeof(int)-sizeof(size_t));      
-  if (v1!=699692586){
+  if (v1!=kPTFifoTag){
      (*fPFree)(ptr);
      return;
   }
   size_t v2=* (size_t *) ((char*)ptr-sizeof(size_t));
 
-  pthread_mutex_lock(&fgPTMutex);
-
-  fPerfData[kPDCurrentHeap]-=v2;
+  DecHeap(v2);
  
   (*fPFree)((char*)ptr-sizeof(int)-sizeof(size_t)); 
+}
 
-  pthread_mutex_unlock(&fgPTMutex);
-
+void PerfTrackMallocInterposition::MarkPhase(int phase) {
+   // End the current phase and start phase; -1 only ends the current one.
+   if (phase >= kPTNumPhases) return;
+
+   long cpu = CPUTime();
+   long wall = WallTime();
+   // Before the first mark everything counts as startup.
+   PTPhaseRecord& prev = fPhases[fCurrentPhase < 0 ? kPTPhaseStartup : fCurrentPhase];
+   if (fCurrentPhase < 0)
+      ++prev.fEntered;
+   prev.fCPUTime += cpu - fPhaseStartCPU;
+   prev.fWallTime += wall - fPhaseStartWall;
+   long rss = ResidentSetSize();
+   if (rss > prev.fRSS)
+      prev.fRSS = rss;
+
+   fCurrentPhase = phase;
+   fPhaseStartCPU = cpu;
+   fPhaseStartWall = wall;
+   if (phase >= 0)
+      ++fPhases[phase].fEntered;
 }
 
 // Replacement symbols:
@@ -200,3 +495,8 @@ void *realloc(void *ptr, size_t size) {
    return PerfTrackMallocInterposition::Instance().Realloc(ptr, size);
 }
 
+// Called by PTMarkPhase(), see pt_phase.h.
+extern "C" void PerfTrackMarkPhase(int phase) {
+   if (phase < 0) return;
+   PerfTrackMallocInterposition::Instance().MarkPhase(phase);
+}
@@ -0,0 +1,29 @@
+#ifndef PT_PHASE_H
+#define PT_PHASE_H
+
+// Lets a test mark the phases of its run (see EPTPhase in pt_fifo.h), such
+// that pt_collector tracks CPU time, wall time and resident memory of each
+// phase separately, e.g.
+//
+//    #include "pt_phase.h"
+//    ...
+//    PTMarkPhase(kPTPhaseSetup);
+//    TFile* f = TFile::Open(...);
+//    PTMarkPhase(kPTPhaseWorkload);
+//    ... the code whose performance matters ...
+//    PTMarkPhase(kPTPhaseTeardown);
+//
+// Marks are ignored unless the test runs under pt_collector (i.e. with
+// ptpreload.so loaded). Phases must be marked by one thread only.
+
+#include <dlfcn.h>
+
+#include "pt_fifo.h"
+
+inline void PTMarkPhase(EPTPhase phase) {
+   typedef void (*PTMarkPhaseFunc_t)(int);
+   static PTMarkPhaseFunc_t func = (PTMarkPhaseFunc_t)dlsym(RTLD_DEFAULT, "PerfTrackMarkPhase");
+   if (func) (*func)(phase);
+}
+
+#endif // PT_PHASE_H